@@ -0,0 +1,485 @@
+// bench_compare.cpp
+// Compares benchmark reports written by `bun_parallel --report-json`. Reports
+// are grouped by configuration (executor, I/O backend, thread count, dataset
+// and output count); within a configuration, reports with the same label are
+// one build, and the first label seen is the baseline the others are compared
+// against.
+//
+// The samples of a build are the per-package install times of all its
+// reports. Reports list packages in the order of the package list, so within
+// a configuration the same package can be matched across builds: each
+// package's time in a build is its median over the build's reports, and the
+// candidate is compared to the baseline with a two-sided Wilcoxon signed-rank
+// test on the per-package differences. The shift is their Hodges-Lehmann
+// estimate (median of the Walsh averages) with its confidence interval. When
+// the package counts do not line up, the builds fall back to a Mann-Whitney U
+// test on the pooled samples, which assumes independent samples; the output
+// marks those rows. A candidate is flagged as a regression when the shift is
+// significant and larger than the threshold, relative to the baseline median;
+// the exit status is then 2.
+//
+// Compile: g++ -O2 -std=c++17 bench_compare.cpp -o bench_compare
+// Usage: ./bench_compare [--threshold PCT] [--alpha A] <report.json>...
+//   --threshold PCT  smallest slowdown to flag, in percent (default 5)
+//   --alpha A        significance level; the interval is 1-A (default 0.05)
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+
+// Just enough JSON for the reports: objects, arrays, strings, numbers, true,
+// false and null.
+struct Json {
+    enum Kind { kNull, kBool, kNumber, kString, kArray, kObject } kind = kNull;
+    double number = 0;
+    std::string str;
+    std::vector<Json> items;
+    std::map<std::string, Json> fields;
+
+    const Json* get(const std::string& key) const {
+        auto it = fields.find(key);
+        return it == fields.end() ? nullptr : &it->second;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : s_(text) {}
+
+    bool parse(Json& out) {
+        if (!value(out)) return false;
+        skip_space();
+        return pos_ == s_.size();
+    }
+
+private:
+    void skip_space() {
+        while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) pos_++;
+    }
+
+    bool literal(const char* word) {
+        size_t n = std::char_traits<char>::length(word);
+        if (s_.compare(pos_, n, word) != 0) return false;
+        pos_ += n;
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (s_[pos_] != '"') return false;
+        pos_++;
+        while (pos_ < s_.size() && s_[pos_] != '"') {
+            char c = s_[pos_++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= s_.size()) return false;
+            char e = s_[pos_++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    // Reports only escape control characters; anything wider
+                    // is kept as '?'.
+                    if (pos_ + 4 > s_.size()) return false;
+                    for (size_t i = pos_; i < pos_ + 4; ++i) {
+                        if (!std::isxdigit(static_cast<unsigned char>(s_[i]))) return false;
+                    }
+                    unsigned code = std::stoul(s_.substr(pos_, 4), nullptr, 16);
+                    out += code < 0x80 ? static_cast<char>(code) : '?';
+                    pos_ += 4;
+                    break;
+                }
+                default: out += e;
+            }
+        }
+        if (pos_ >= s_.size()) return false;
+        pos_++;
+        return true;
+    }
+
+    bool value(Json& out) {
+        skip_space();
+        if (pos_ >= s_.size()) return false;
+        char c = s_[pos_];
+        if (c == '{') {
+            out.kind = Json::kObject;
+            pos_++;
+            skip_space();
+            if (pos_ < s_.size() && s_[pos_] == '}') return ++pos_, true;
+            while (true) {
+                skip_space();
+                std::string key;
+                if (pos_ >= s_.size() || !string(key)) return false;
+                skip_space();
+                if (pos_ >= s_.size() || s_[pos_++] != ':') return false;
+                if (!value(out.fields[key])) return false;
+                skip_space();
+                if (pos_ >= s_.size()) return false;
+                if (s_[pos_] == '}') return ++pos_, true;
+                if (s_[pos_++] != ',') return false;
+            }
+        }
+        if (c == '[') {
+            out.kind = Json::kArray;
+            pos_++;
+            skip_space();
+            if (pos_ < s_.size() && s_[pos_] == ']') return ++pos_, true;
+            while (true) {
+                out.items.emplace_back();
+                if (!value(out.items.back())) return false;
+                skip_space();
+                if (pos_ >= s_.size()) return false;
+                if (s_[pos_] == ']') return ++pos_, true;
+                if (s_[pos_++] != ',') return false;
+            }
+        }
+        if (c == '"') {
+            out.kind = Json::kString;
+            return string(out.str);
+        }
+        if (literal("true")) {
+            out.kind = Json::kBool;
+            out.number = 1;
+            return true;
+        }
+        if (literal("false")) {
+            out.kind = Json::kBool;
+            return true;
+        }
+        if (literal("null")) return true;
+        const char* begin = s_.c_str() + pos_;
+        char* end = nullptr;
+        out.number = std::strtod(begin, &end);
+        if (end == begin) return false;
+        out.kind = Json::kNumber;
+        pos_ += end - begin;
+        return true;
+    }
+
+    const std::string& s_;
+    size_t pos_ = 0;
+};
+
+struct Build {
+    std::string label;
+    int reports = 0;
+    std::vector<double> walls;    // seconds, one per report
+    std::vector<double> samples;  // package seconds of all reports
+    std::vector<std::vector<double>> runs;  // package seconds of each report, in list order
+};
+
+// Builds of one configuration, in the order their labels were first seen.
+struct ConfigGroup {
+    std::string key;
+    std::vector<Build> builds;
+};
+
+double median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    size_t mid = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + mid, v.end());
+    double hi = v[mid];
+    if (v.size() % 2) return hi;
+    return (*std::max_element(v.begin(), v.begin() + mid) + hi) / 2;
+}
+
+// Inverse of the standard normal CDF (Acklam's rational approximation,
+// relative error below 1.2e-9), used for the interval's critical value.
+double normal_quantile(double p) {
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    if (p < 0.02425) {
+        double q = std::sqrt(-2 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    if (p > 1 - 0.02425) return -normal_quantile(1 - p);
+    double q = p - 0.5, r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+struct Comparison {
+    double p = 1;      // two-sided p-value
+    double shift = 0;  // Hodges-Lehmann estimate of candidate - baseline
+    double lo = 0, hi = 0;
+    bool paired = false;
+};
+
+// Keeps at most `cap` evenly spaced samples of a sorted vector, so the
+// pairwise differences of two large runs stay affordable.
+std::vector<double> thin(const std::vector<double>& sorted, size_t cap) {
+    if (sorted.size() <= cap) return sorted;
+    std::vector<double> out;
+    for (size_t i = 0; i < cap; ++i) out.push_back(sorted[i * sorted.size() / cap]);
+    return out;
+}
+
+// 1. U from the joint ranks (ties get their mean rank), with the normal
+//    approximation and tie correction for the p-value.
+// 2. The shift estimate is the median of all pairwise differences; its
+//    interval takes the differences at the critical ranks of U.
+Comparison compare(std::vector<double> x, std::vector<double> y, double alpha) {
+    Comparison r;
+    double n = x.size(), m = y.size();
+    if (x.empty() || y.empty()) return r;
+
+    std::vector<std::pair<double, int>> all;
+    for (double v : x) all.push_back({v, 0});
+    for (double v : y) all.push_back({v, 1});
+    std::sort(all.begin(), all.end());
+    double rank_sum_y = 0, tie_term = 0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) j++;
+        double mean_rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (all[k].second) rank_sum_y += mean_rank;
+        }
+        double t = j - i;
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    double u = rank_sum_y - m * (m + 1) / 2;
+    double total = n + m;
+    double var = n * m / 12 * ((total + 1) - tie_term / (total * (total - 1)));
+    if (var > 0) {
+        double z = (std::abs(u - n * m / 2) - 0.5) / std::sqrt(var);
+        r.p = std::min(1.0, std::erfc(std::max(0.0, z) / std::sqrt(2.0)));
+    }
+
+    std::sort(x.begin(), x.end());
+    std::sort(y.begin(), y.end());
+    x = thin(x, 2000);
+    y = thin(y, 2000);
+    std::vector<double> diffs;
+    diffs.reserve(x.size() * y.size());
+    for (double b : y) {
+        for (double a : x) diffs.push_back(b - a);
+    }
+    std::sort(diffs.begin(), diffs.end());
+    size_t k = diffs.size();
+    r.shift = diffs.size() % 2 ? diffs[k / 2] : (diffs[k / 2 - 1] + diffs[k / 2]) / 2;
+    double nx = x.size(), ny = y.size();
+    double crit = nx * ny / 2 - normal_quantile(1 - alpha / 2) * std::sqrt(nx * ny * (nx + ny + 1) / 12);
+    size_t c = crit < 1 ? 1 : std::min(k, static_cast<size_t>(crit));
+    r.lo = diffs[c - 1];
+    r.hi = diffs[k - c];
+    return r;
+}
+
+// Each package's median time over a build's reports, or empty if the reports
+// do not all list the same number of packages.
+std::vector<double> per_package(const Build& b) {
+    std::vector<double> out;
+    for (const auto& run : b.runs) {
+        if (run.size() != b.runs[0].size()) return {};
+    }
+    for (size_t i = 0; i < b.runs[0].size(); ++i) {
+        std::vector<double> v;
+        for (const auto& run : b.runs) v.push_back(run[i]);
+        out.push_back(median(v));
+    }
+    return out;
+}
+
+// Paired comparison of the same packages in two builds.
+// 1. Wilcoxon signed-rank statistic over the nonzero differences (ties get
+//    their mean rank), with the normal approximation and tie correction.
+// 2. The shift estimate is the median of the Walsh averages (d_i + d_j) / 2,
+//    i <= j; its interval takes the averages at the critical ranks of the
+//    signed-rank statistic.
+Comparison compare_paired(const std::vector<double>& x, const std::vector<double>& y, double alpha) {
+    Comparison r;
+    r.paired = true;
+    std::vector<double> d;
+    for (size_t i = 0; i < x.size(); ++i) d.push_back(y[i] - x[i]);
+    if (d.empty()) return r;
+
+    std::vector<std::pair<double, bool>> nonzero;  // |d|, d > 0
+    for (double v : d) {
+        if (v != 0) nonzero.push_back({std::abs(v), v > 0});
+    }
+    std::sort(nonzero.begin(), nonzero.end());
+    double w_plus = 0, tie_term = 0;
+    for (size_t i = 0; i < nonzero.size();) {
+        size_t j = i;
+        while (j < nonzero.size() && nonzero[j].first == nonzero[i].first) j++;
+        double mean_rank = (i + 1 + j) / 2.0;
+        for (size_t k = i; k < j; ++k) {
+            if (nonzero[k].second) w_plus += mean_rank;
+        }
+        double t = j - i;
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    double n = nonzero.size();
+    double var = n * (n + 1) * (2 * n + 1) / 24 - tie_term / 48;
+    if (var > 0) {
+        double z = (std::abs(w_plus - n * (n + 1) / 4) - 0.5) / std::sqrt(var);
+        r.p = std::min(1.0, std::erfc(std::max(0.0, z) / std::sqrt(2.0)));
+    }
+
+    std::sort(d.begin(), d.end());
+    d = thin(d, 2000);
+    std::vector<double> walsh;
+    walsh.reserve(d.size() * (d.size() + 1) / 2);
+    for (size_t i = 0; i < d.size(); ++i) {
+        for (size_t j = i; j < d.size(); ++j) walsh.push_back((d[i] + d[j]) / 2);
+    }
+    std::sort(walsh.begin(), walsh.end());
+    size_t k = walsh.size();
+    r.shift = k % 2 ? walsh[k / 2] : (walsh[k / 2 - 1] + walsh[k / 2]) / 2;
+    double nd = d.size();
+    double crit = nd * (nd + 1) / 4 - normal_quantile(1 - alpha / 2) * std::sqrt(nd * (nd + 1) * (2 * nd + 1) / 24);
+    size_t c = crit < 1 ? 1 : std::min(k, static_cast<size_t>(crit));
+    r.lo = walsh[c - 1];
+    r.hi = walsh[k - c];
+    return r;
+}
+
+bool load_report(const std::string& path, std::string& key, std::string& label, double& wall,
+                 std::vector<double>& samples) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string text = buf.str();
+    Json doc;
+    if (!JsonParser(text).parse(doc) || doc.kind != Json::kObject) return false;
+    const Json* config = doc.get("config");
+    const Json* packages = doc.get("package_seconds");
+    if (!config || config->kind != Json::kObject || !packages || packages->kind != Json::kArray) return false;
+
+    std::ostringstream k;
+    for (const char* field : {"executor", "backend", "threads", "dataset", "outputs"}) {
+        const Json* v = config->get(field);
+        if (!v) continue;
+        if (k.tellp() > 0) k << " ";
+        if (v->kind == Json::kString) k << v->str;
+        else k << (std::string(field) == "threads" ? "t" : "o") << v->number;
+    }
+    key = k.str();
+    const Json* l = doc.get("label");
+    label = l && l->kind == Json::kString ? l->str : path;
+    const Json* w = doc.get("wall_seconds");
+    wall = w ? w->number : 0;
+    for (const auto& v : packages->items) {
+        if (v.kind == Json::kNumber) samples.push_back(v.number);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    double threshold = 5.0;
+    double alpha = 0.05;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else if (a == "--alpha" && i + 1 < argc) {
+            alpha = std::atof(argv[++i]);
+        } else {
+            files.push_back(a);
+        }
+    }
+    if (files.size() < 2 || alpha <= 0 || alpha >= 1 || threshold < 0) {
+        std::cerr << "Usage: " << argv[0] << " [--threshold PCT] [--alpha A] <report.json>...\n";
+        return 1;
+    }
+
+    std::vector<ConfigGroup> groups;
+    for (const auto& f : files) {
+        std::string key, label;
+        double wall = 0;
+        std::vector<double> samples;
+        if (!load_report(f, key, label, wall, samples)) {
+            std::cerr << "Error: Cannot read report " << f << "\n";
+            return 1;
+        }
+        auto g = std::find_if(groups.begin(), groups.end(), [&](const ConfigGroup& c) { return c.key == key; });
+        if (g == groups.end()) {
+            groups.push_back({key, {}});
+            g = groups.end() - 1;
+        }
+        auto b = std::find_if(g->builds.begin(), g->builds.end(), [&](const Build& x) { return x.label == label; });
+        if (b == g->builds.end()) {
+            g->builds.push_back({label, 0, {}, {}, {}});
+            b = g->builds.end() - 1;
+        }
+        b->reports++;
+        b->walls.push_back(wall);
+        b->samples.insert(b->samples.end(), samples.begin(), samples.end());
+        b->runs.push_back(std::move(samples));
+    }
+
+    int ci = static_cast<int>(std::lround(100 * (1 - alpha)));
+    std::cout << std::left << std::setw(16) << "build" << std::right << std::setw(5) << "runs" << std::setw(8)
+              << "pkgs" << std::setw(10) << "wall s" << std::setw(10) << "p50 ms" << std::setw(9) << "change"
+              << std::setw(20) << (std::to_string(ci) + "% CI") << std::setw(9) << "p" << "  verdict\n";
+    int regressions = 0, compared = 0, unpaired = 0;
+    for (const auto& g : groups) {
+        std::cout << "[" << g.key << "]\n";
+        const Build& base = g.builds[0];
+        double base_median = median(base.samples);
+        std::vector<double> base_packages = per_package(base);
+        for (const auto& b : g.builds) {
+            std::cout << std::left << std::setw(16) << b.label.substr(0, 15) << std::right << std::setw(5)
+                      << b.reports << std::setw(8) << b.samples.size() << std::fixed << std::setprecision(3)
+                      << std::setw(10) << median(b.walls) << std::setw(10) << 1e3 * median(b.samples);
+            if (&b == &base) {
+                std::cout << std::setw(9) << "-" << std::setw(20) << "-" << std::setw(9) << "-" << "  baseline\n";
+                continue;
+            }
+            std::vector<double> packages = per_package(b);
+            Comparison c = !base_packages.empty() && packages.size() == base_packages.size()
+                               ? compare_paired(base_packages, packages, alpha)
+                               : compare(base.samples, b.samples, alpha);
+            double scale = base_median > 0 ? 100 / base_median : 0;
+            std::ostringstream change, interval;
+            change << std::showpos << std::fixed << std::setprecision(1) << c.shift * scale << "%";
+            interval << std::showpos << std::fixed << std::setprecision(1) << "[" << c.lo * scale << ", "
+                     << c.hi * scale << "]%";
+            const char* verdict = "same";
+            if (c.p < alpha && c.shift * scale > threshold) {
+                verdict = "REGRESSION";
+                regressions++;
+            } else if (c.p < alpha && -c.shift * scale > threshold) {
+                verdict = "faster";
+            } else if (c.p < alpha) {
+                verdict = "within threshold";
+            }
+            compared++;
+            if (!c.paired) unpaired++;
+            std::cout << std::setw(9) << change.str() << std::setw(20) << interval.str() << std::setw(9)
+                      << std::setprecision(4) << c.p << "  " << verdict << (c.paired ? "" : " (unpaired)") << "\n";
+        }
+    }
+    if (compared == 0) {
+        std::cout << "No configuration has more than one build to compare; label reports with --report-label.\n";
+    }
+    if (unpaired) {
+        std::cout << "Rows marked (unpaired) list different packages than their baseline; they use a "
+                     "Mann-Whitney U test, which assumes independent package times.\n";
+    }
+    return regressions ? 2 : 0;
+}
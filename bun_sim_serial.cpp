@@ -5,7 +5,8 @@
 // performance comparison with the parallel version.
 //
 // Compile: g++ -O2 -std=c++17 bun_sim_serial.cpp -o bun_serial
-// Usage: ./bun_serial <packages_list.txt> <output_dir>
+// Usage: ./bun_serial [--work-* ...] <packages_list.txt> <output_dir>
+// --work-* options add modelled CPU work per file; see workload.h.
 // packages_list.txt: each line: <pkg_dir> (pkg_dir contains manifest.json and files/ subdir)
 // Example: ./bun_serial packages.txt out_serial
 
@@ -19,6 +20,8 @@
 #include <iomanip>
 #include <iterator>
 
+#include "workload.h"
+
 namespace fs = std::filesystem;
 using Clock = std::chrono::steady_clock;
 
@@ -34,6 +37,11 @@ uint64_t checksum_bytes(const std::vector<char>& data) {
     return h;
 }
 
+// Extra modelled CPU work per file, identical to the parallel version's so the
+// two binaries can be compared at the same CPU/I/O ratio.
+WorkloadModel g_workload;
+uint64_t g_workload_sink = 0;
+
 // Processes a single package serially.
 // Returns the time taken in seconds.
 double process_package_serial(const fs::path& pkg_dir, const fs::path& out_dir) {
@@ -71,6 +79,7 @@ double process_package_serial(const fs::path& pkg_dir, const fs::path& out_dir)
 
         // b. Process file contents (CPU-bound)
         uint64_t cs = checksum_bytes(buf);
+        if (g_workload.enabled()) g_workload_sink ^= workload_apply(g_workload, buf);
 
         // c. Write file to output directory (I/O-bound)
         fs::path out_file = out_pkg / p.path().filename();
@@ -93,12 +102,18 @@ double process_package_serial(const fs::path& pkg_dir, const fs::path& out_dir)
 }
 
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <packages_list.txt> <output_dir>\n";
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        int w = workload_parse_option(i, argc, argv, g_workload);
+        if (w < 0) return 1;
+        if (w == 0) args.push_back(argv[i]);
+    }
+    if (args.size() < 2) {
+        std::cerr << "Usage: " << argv[0] << " [--work-* ...] <packages_list.txt> <output_dir>\n";
         return 1;
     }
-    fs::path listfile = argv[1];
-    fs::path outdir = argv[2];
+    fs::path listfile = args[0];
+    fs::path outdir = args[1];
     fs::create_directories(outdir);
 
     // Read all package directories from the list file
@@ -110,6 +125,7 @@ int main(int argc, char** argv) {
         pkg_dirs.push_back(fs::path(line));
     }
 
+    workload_calibrate(g_workload);
     std::cout << "Starting serial processing of " << pkg_dirs.size() << " packages...\n\n";
     auto t0 = Clock::now();
 
@@ -130,6 +146,9 @@ int main(int argc, char** argv) {
     std::cout << "Processed " << pkg_dirs.size() << " packages in "
               << std::fixed << std::setprecision(4) << dur.count()
               << " seconds (serial execution)." << std::endl;
+    if (g_workload.enabled()) {
+        std::cout << workload_describe(g_workload) << " [" << (g_workload_sink & 0xF) << "]\n";
+    }
     std::cout << "--------------------------------------------------\n";
 
     return 0;
@@ -0,0 +1,74 @@
+"""Regression test for coro_install: a slow package at the head of the list.
+
+Builds a list whose first package is large (200 files of 200 KB) followed by
+19 small ones, and installs it with fewer lanes than packages on both I/O
+backends. While the head package is still running, the other lanes finish
+later packages, whose ledger records must be buffered without blocking a
+worker thread. Each run must finish within the timeout, exit 0, and leave
+install_db.txt in list order.
+
+Usage: python coro_ledger_test.py [--binary ./coro_install] <scratch_dir>
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+
+
+def make_package(path, files, size):
+    os.makedirs(os.path.join(path, "files"), exist_ok=True)
+    with open(os.path.join(path, "manifest.json"), "w") as f:
+        f.write(f'{{"name":"{os.path.basename(path)}","version":"1.0.0"}}\n')
+    for j in range(1, files + 1):
+        with open(os.path.join(path, "files", f"f{j}.bin"), "wb") as f:
+            f.write(os.urandom(size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="coro_install slow-head regression test")
+    parser.add_argument("--binary", default="./coro_install")
+    parser.add_argument("--timeout", type=float, default=60)
+    parser.add_argument("scratch")
+    args = parser.parse_args()
+
+    src = os.path.join(args.scratch, "pkgs")
+    shutil.rmtree(src, ignore_errors=True)
+    names = ["head"] + [f"small{i:02d}" for i in range(1, 20)]
+    make_package(os.path.join(src, names[0]), 200, 200 * 1024)
+    for name in names[1:]:
+        make_package(os.path.join(src, name), 5, 2048)
+    listfile = os.path.join(args.scratch, "slow_head.txt")
+    with open(listfile, "w") as f:
+        f.writelines(os.path.join(src, n) + "\n" for n in names)
+
+    failures = 0
+    for backend in ("uring", "threads"):
+        for workers, inflight in ((1, 2), (2, 3), (4, 8)):
+            out = os.path.join(args.scratch, "out")
+            shutil.rmtree(out, ignore_errors=True)
+            cmd = [args.binary, "--backend", backend, "--workers", str(workers), "--inflight", str(inflight),
+                   listfile, out]
+            case = f"{backend} workers={workers} inflight={inflight}"
+            try:
+                rc = subprocess.run(cmd, stdout=subprocess.DEVNULL, timeout=args.timeout).returncode
+            except subprocess.TimeoutExpired:
+                print(f"FAIL {case}: no exit within {args.timeout:g} s")
+                failures += 1
+                continue
+            with open(os.path.join(out, "install_db.txt")) as f:
+                ledger = [line.split()[0] for line in f]
+            if rc != 0 or ledger != names:
+                print(f"FAIL {case}: exit {rc}, ledger {ledger}")
+                failures += 1
+            else:
+                print(f"ok   {case}")
+    shutil.rmtree(src, ignore_errors=True)
+    shutil.rmtree(os.path.join(args.scratch, "out"), ignore_errors=True)
+    os.remove(listfile)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,121 @@
+// energy.h
+// Energy and CPU-time accounting for the parallel simulator (--energy). Energy
+// comes from the Linux powercap RAPL counters: every package domain
+// (intel-rapl:N, named package-N) and every DRAM sub-domain. Core and uncore
+// sub-domains are skipped because the package domain already contains them.
+// CPU time is the process's user+system time from getrusage, so it counts
+// every thread, including the hedge pool and the sampler.
+//
+// The run is split into phases by mark(); each phase records wall time,
+// package and DRAM joules and CPU seconds. RAPL counters wrap at
+// max_energy_range_uj, and one wrap per phase is undone. Recent kernels make
+// energy_uj readable by root only; when no counter can be read, only the CPU
+// time is reported.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+struct RaplDomain {
+    std::string name;  // package-0, dram, ...
+    std::filesystem::path counter;
+    uint64_t range_uj = 0;
+    bool dram = false;
+};
+
+struct EnergyPhase {
+    std::string name;
+    double seconds = 0;
+    double package_j = 0;
+    double dram_j = 0;
+    double cpu_seconds = 0;
+};
+
+class EnergyMeter {
+public:
+    // Finds the readable RAPL domains and takes the first reading.
+    void start() {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        for (const auto& e : fs::directory_iterator("/sys/class/powercap", ec)) {
+            std::string zone = e.path().filename().string();
+            if (zone.rfind("intel-rapl:", 0) != 0) continue;
+            RaplDomain d;
+            std::ifstream(e.path() / "name") >> d.name;
+            std::ifstream(e.path() / "max_energy_range_uj") >> d.range_uj;
+            d.counter = e.path() / "energy_uj";
+            d.dram = d.name == "dram";
+            if (!d.dram && d.name.rfind("package", 0) != 0) continue;
+            uint64_t probe;
+            if (!read_uj(d.counter, probe)) continue;
+            domains_.push_back(d);
+        }
+        last_ = reading();
+    }
+
+    bool has_rapl() const { return !domains_.empty(); }
+    const std::vector<RaplDomain>& domains() const { return domains_; }
+
+    // Ends the current phase under the given name and starts the next one.
+    void mark(const std::string& name) {
+        Reading now = reading();
+        EnergyPhase p;
+        p.name = name;
+        p.seconds = std::chrono::duration<double>(now.at - last_.at).count();
+        p.cpu_seconds = now.cpu_seconds - last_.cpu_seconds;
+        for (size_t d = 0; d < domains_.size(); ++d) {
+            uint64_t delta = now.uj[d] >= last_.uj[d] ? now.uj[d] - last_.uj[d]
+                                                       : now.uj[d] + domains_[d].range_uj - last_.uj[d];
+            (domains_[d].dram ? p.dram_j : p.package_j) += delta / 1e6;
+        }
+        phases_.push_back(p);
+        last_ = std::move(now);
+    }
+
+    const std::vector<EnergyPhase>& phases() const { return phases_; }
+
+    EnergyPhase total() const {
+        EnergyPhase t;
+        t.name = "total";
+        for (const auto& p : phases_) {
+            t.seconds += p.seconds;
+            t.package_j += p.package_j;
+            t.dram_j += p.dram_j;
+            t.cpu_seconds += p.cpu_seconds;
+        }
+        return t;
+    }
+
+private:
+    struct Reading {
+        std::chrono::steady_clock::time_point at;
+        double cpu_seconds = 0;
+        std::vector<uint64_t> uj;  // in domains_ order
+    };
+
+    static bool read_uj(const std::filesystem::path& counter, uint64_t& uj) {
+        std::ifstream in(counter);
+        return static_cast<bool>(in >> uj);
+    }
+
+    Reading reading() const {
+        Reading r;
+        r.at = std::chrono::steady_clock::now();
+        rusage ru{};
+        ::getrusage(RUSAGE_SELF, &ru);
+        r.cpu_seconds = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        r.uj.resize(domains_.size());
+        for (size_t d = 0; d < domains_.size(); ++d) read_uj(domains_[d].counter, r.uj[d]);
+        return r;
+    }
+
+    std::vector<RaplDomain> domains_;
+    std::vector<EnergyPhase> phases_;
+    Reading last_;
+};
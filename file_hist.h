@@ -0,0 +1,102 @@
+// file_hist.h
+// Per-file latency and throughput histograms of the install loop, split by
+// phase (read, hash, write) and by file size class, so a regression in one
+// class of files is not averaged away by the others. Each thread records into
+// its own FileHistograms; they are merged once the loop is done.
+//
+// Export format (--hist-out FILE), one line per non-empty bucket after a
+// "# bun_parallel file histograms v1 host=<host> threads=<n>" header:
+//   <phase> <size class> <latency_ns|mbps> <bucket lower bound> <count>
+// Files from different runs or hosts can be diffed or loaded bucket by bucket.
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unistd.h>
+
+#include "latency_hist.h"
+
+enum FilePhase { kPhaseRead, kPhaseHash, kPhaseWrite, kPhases };
+constexpr int kSizeClasses = 5;
+
+inline const char* phase_name(int p) {
+    static const char* names[] = {"read", "hash", "write"};
+    return names[p];
+}
+
+inline int size_class(uint64_t bytes) {
+    if (bytes < (4u << 10)) return 0;
+    if (bytes < (64u << 10)) return 1;
+    if (bytes < (1u << 20)) return 2;
+    if (bytes < (16u << 20)) return 3;
+    return 4;
+}
+
+inline const char* size_class_name(int c) {
+    static const char* names[] = {"<4K", "4K-64K", "64K-1M", "1M-16M", ">=16M"};
+    return names[c];
+}
+
+struct FileHistograms {
+    LatencyHist latency[kPhases][kSizeClasses];  // nanoseconds per file
+    LatencyHist mbps[kPhases][kSizeClasses];     // per-file throughput, MB/s
+
+    void record(FilePhase phase, uint64_t bytes, uint64_t ns) {
+        int c = size_class(bytes);
+        latency[phase][c].add(ns);
+        if (bytes > 0) mbps[phase][c].add(bytes * 1000 / (ns ? ns : 1));
+    }
+
+    void merge(const FileHistograms& o) {
+        for (int p = 0; p < kPhases; ++p) {
+            for (int c = 0; c < kSizeClasses; ++c) {
+                latency[p][c].merge(o.latency[p][c]);
+                mbps[p][c].merge(o.mbps[p][c]);
+            }
+        }
+    }
+};
+
+// Prints latency quantiles (microseconds) and median throughput for every
+// phase and size class that saw a file.
+inline void print_file_histograms(std::ostream& out, const FileHistograms& h) {
+    out << std::left << std::setw(7) << "phase" << std::setw(8) << "size" << std::right << std::setw(8)
+        << "files" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+        << std::setw(10) << "p99.9 us" << std::setw(10) << "max us" << std::setw(10) << "p50 MB/s" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (int p = 0; p < kPhases; ++p) {
+        for (int c = 0; c < kSizeClasses; ++c) {
+            const LatencyHist& l = h.latency[p][c];
+            if (l.total == 0) continue;
+            out << std::left << std::setw(7) << phase_name(p) << std::setw(8) << size_class_name(c) << std::right
+                << std::setw(8) << l.total.load();
+            for (double q : {50.0, 90.0, 99.0, 99.9, 100.0}) out << std::setw(10) << l.value_at(q) / 1e3;
+            out << std::setw(10) << h.mbps[p][c].value_at(50) << "\n";
+        }
+    }
+}
+
+inline bool write_file_histograms(const std::string& path, const FileHistograms& h, int threads) {
+    std::ofstream out(path, std::ios::trunc);
+    char host[256] = "unknown";
+    ::gethostname(host, sizeof(host) - 1);
+    out << "# bun_parallel file histograms v1 host=" << host << " threads=" << threads << "\n";
+    for (int p = 0; p < kPhases; ++p) {
+        for (int c = 0; c < kSizeClasses; ++c) {
+            for (int m = 0; m < 2; ++m) {
+                const LatencyHist& l = m ? h.mbps[p][c] : h.latency[p][c];
+                for (int b = 0; b < LatencyHist::kBuckets; ++b) {
+                    uint64_t n = l.counts[b].load();
+                    if (n == 0) continue;
+                    out << phase_name(p) << " " << size_class_name(c) << " " << (m ? "mbps" : "latency_ns") << " "
+                        << LatencyHist::lower(b) << " " << n << "\n";
+                }
+            }
+        }
+    }
+    return static_cast<bool>(out);
+}
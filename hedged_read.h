@@ -0,0 +1,224 @@
+// hedged_read.h
+// Hedged reads for straggling storage (--hedge P). On network filesystems a
+// small fraction of reads take many times the median, and the whole install
+// waits on them. With hedging, every read of the install loop runs on a small
+// I/O pool; if it is still outstanding after the P-th percentile of recent
+// read latencies, the same read is issued again on another pool thread. The
+// caller takes whichever copy succeeds first and cancels the other: a copy
+// still queued or in an injected delay (io_shim.h) gives up at once, one
+// blocked in the kernel finishes and its data is dropped. The latency of every
+// first copy is kept, cancelled ones including the delay they skipped, so the
+// run can report the tail it would have had without hedging.
+//
+// Options:
+//   --hedge P          hedge reads slower than the P-th percentile (e.g. 95)
+//   --hedge-min-us N   never hedge before N microseconds (default 200)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <omp.h>
+
+#include "io_shim.h"
+#include "latency_hist.h"
+
+struct HedgeConfig {
+    double percentile = 0;  // 0 = hedging off
+    uint64_t min_us = 200;
+    uint64_t warmup = 32;  // reads observed before the first hedge
+
+    bool enabled() const { return percentile > 0; }
+};
+
+struct HedgeStats {
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> hedges{0};      // duplicate reads issued
+    std::atomic<uint64_t> hedge_wins{0};  // reads answered by the duplicate
+    LatencyHist primary;   // latency of each first copy, as if unhedged
+    LatencyHist observed;  // latency seen by the caller
+};
+
+inline HedgeConfig g_hedge;
+inline HedgeStats g_hedge_stats;
+
+// Parses one --hedge option at argv[i], advancing i past its value. Returns 1
+// if consumed, 0 if not a hedge option, -1 (after printing) on bad input.
+inline int hedge_parse_option(int& i, int argc, char** argv) {
+    std::string a = argv[i];
+    if (a != "--hedge" && a != "--hedge-min-us") return 0;
+    if (i + 1 >= argc) {
+        std::cerr << "Error: " << a << " needs a value\n";
+        return -1;
+    }
+    char* end = nullptr;
+    double d = std::strtod(argv[++i], &end);
+    if (*end != '\0' || d < 0 || (a == "--hedge" && (d <= 0 || d >= 100))) {
+        std::cerr << "Error: " << a << (a == "--hedge" ? " expects a percentile between 0 and 100\n"
+                                                       : " expects a non-negative number\n");
+        return -1;
+    }
+    if (a == "--hedge") g_hedge.percentile = d;
+    else g_hedge.min_us = static_cast<uint64_t>(d);
+    return 1;
+}
+
+// Current hedge threshold in microseconds, or 0 while too few reads have been
+// seen to know the distribution.
+inline uint64_t hedge_threshold_us() {
+    if (g_hedge_stats.primary.total.load(std::memory_order_relaxed) < g_hedge.warmup) return 0;
+    uint64_t t = g_hedge_stats.primary.value_at(g_hedge.percentile);
+    return t < g_hedge.min_us ? g_hedge.min_us : t;
+}
+
+// Threads that run the copies of hedged reads. Sized for one primary and one
+// hedge per OpenMP thread; started on first use.
+class HedgePool {
+public:
+    void submit(std::function<void()> task) {
+        std::call_once(started_, [this] {
+            int n = 2 * omp_get_max_threads();
+            for (int i = 0; i < n; ++i) threads_.emplace_back([this] { run(); });
+        });
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            queue_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+    ~HedgePool() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                task = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::once_flag started_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+inline HedgePool g_hedge_pool;
+
+// Shared by the caller and both copies of one read. It owns a dup of the
+// caller's descriptor and a buffer per copy, so a losing copy can finish after
+// the caller has returned and closed its own descriptor.
+struct HedgedRead {
+    using Clock = std::chrono::steady_clock;
+
+    int fd = -1;
+    Clock::time_point start;
+    std::vector<char> buf[2];
+    ssize_t result[2] = {-1, -1};
+    int err[2] = {0, 0};
+    bool done[2] = {false, false};
+    int launched = 0;
+    int winner = -1;
+    std::atomic<bool> cancel[2] = {};
+    std::mutex mu;
+    std::condition_variable cv;
+
+    bool finished() const { return winner >= 0 || (done[0] && (launched < 2 || done[1])); }
+    ~HedgedRead() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+// Reads up to n bytes from fd into buf with hedging. attempt(lane, fd, dst,
+// cancel) performs one copy of the read (lane 0 primary, 1 hedge) and
+// returns like pread, setting errno on failure; it runs on a pool thread and
+// may outlive this call, so it must not capture anything by reference.
+template <typename Attempt>
+ssize_t hedged_pread(int fd, char* buf, size_t n, Attempt attempt) {
+    using Clock = HedgedRead::Clock;
+    auto st = std::make_shared<HedgedRead>();
+    st->fd = ::dup(fd);
+    if (st->fd < 0) return attempt(0, fd, buf, nullptr);
+    st->start = Clock::now();
+    g_hedge_stats.reads++;
+
+    auto launch = [&](int lane) {
+        st->buf[lane].resize(n);
+        st->launched = lane + 1;
+        g_hedge_pool.submit([st, lane, attempt] {
+            ssize_t r = -1;
+            int e = ECANCELED;
+            g_io_shim_skipped_us = 0;
+            if (!st->cancel[lane]) {
+                r = attempt(lane, st->fd, st->buf[lane].data(), &st->cancel[lane]);
+                e = r < 0 ? errno : 0;
+            }
+            if (lane == 0) {
+                // A cancelled primary counts with the injected delay it skipped.
+                double us = std::chrono::duration<double, std::micro>(Clock::now() - st->start).count();
+                g_hedge_stats.primary.add(static_cast<uint64_t>(us + (e == ECANCELED ? g_io_shim_skipped_us : 0)));
+            }
+            std::lock_guard<std::mutex> lock(st->mu);
+            st->result[lane] = r;
+            st->err[lane] = e;
+            st->done[lane] = true;
+            if (r >= 0 && st->winner < 0) st->winner = lane;
+            st->cv.notify_all();
+        });
+    };
+
+    uint64_t threshold = hedge_threshold_us();
+    std::unique_lock<std::mutex> lock(st->mu);
+    launch(0);
+    if (threshold > 0 &&
+        !st->cv.wait_for(lock, std::chrono::microseconds(threshold), [&] { return st->finished(); })) {
+        g_hedge_stats.hedges++;
+        launch(1);
+    }
+    st->cv.wait(lock, [&] { return st->finished(); });
+
+    ssize_t r = -1;
+    int e = st->err[0];
+    if (st->winner >= 0) {
+        r = st->result[st->winner];
+        std::memcpy(buf, st->buf[st->winner].data(), static_cast<size_t>(r));
+        st->cancel[1 - st->winner] = true;
+        if (st->winner == 1) g_hedge_stats.hedge_wins++;
+    }
+    lock.unlock();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - st->start);
+    g_hedge_stats.observed.add(static_cast<uint64_t>(us.count()));
+    errno = e;
+    return r;
+}
@@ -0,0 +1,115 @@
+// installer.h
+// Library API of the install engine, for build tools that embed it instead of
+// running bun_parallel and reading its output. Compile parallel.cpp with
+// -DBUN_LIBRARY to leave out main() and link the object into the tool:
+//   g++ -O2 -fopenmp -std=c++17 -DBUN_LIBRARY -c parallel.cpp -o bun_installer.o
+//   g++ -O2 -fopenmp -std=c++17 tool.cpp bun_installer.o -o tool
+//
+// Installer::submit queues a list of packages for one output directory and
+// returns at once with an InstallHandle. Every submission to an Installer runs
+// on its one pool of worker threads; workers take packages from the active
+// submissions in turn, so concurrent submissions share the workers evenly and
+// the host is never oversubscribed. Installer::shared() is a process-wide
+// pool for tools with several independent users.
+//
+// Each submission writes its own install_db.txt (in list order, see
+// ledger_reorder.h) and install_merkle.txt, and installs with its own
+// InstallOptions, so concurrent submissions may differ in upgrade mode,
+// relocation and sparse copy. Process-wide settings that the command line sets
+// through globals (--lazy, --io-*, --hedge, --work-*) apply to every
+// submission alike.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "straggler.h"
+
+struct PackageResult {
+    enum Status { kPending, kInstalled, kFailed, kCancelled };
+
+    std::string name;
+    Status status = kPending;
+    std::string merkle;                         // hex Merkle root, as in the ledger
+    std::map<std::string, uint64_t> checksums;  // installed file name -> checksum
+    uint64_t files = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    double seconds = 0;
+    PhaseTimes phases;
+};
+
+struct InstallOptions {
+    bool upgrade = false;  // see --upgrade
+    bool sparse = true;    // false: see --no-sparse
+    // (FROM, TO) prefix rules, see --relocate; FROM must be at least 2 bytes.
+    std::vector<std::pair<std::string, std::string>> relocate;
+    size_t ledger_window = 1024;  // see --ledger-window
+    // Called on a worker thread after every package, with the number of the
+    // submission's packages finished so far. Must not throw.
+    std::function<void(const PackageResult& result, size_t done, size_t total)> on_package;
+};
+
+struct InstallJob;
+
+class InstallHandle {
+public:
+    InstallHandle() = default;
+
+    // Packages not yet started are skipped and reported as kCancelled;
+    // packages already running finish.
+    void cancel();
+    size_t completed() const;
+    size_t total() const;
+    bool done() const;
+    // Results in the order the packages were submitted, once all are done.
+    std::shared_future<std::vector<PackageResult>> future() const;
+    const std::vector<PackageResult>& wait() const;
+
+private:
+    friend class Installer;
+    explicit InstallHandle(std::shared_ptr<InstallJob> job);
+
+    std::shared_ptr<InstallJob> job_;
+    std::shared_future<std::vector<PackageResult>> future_;
+};
+
+class Installer {
+public:
+    // threads <= 0 uses omp_get_max_threads().
+    explicit Installer(int threads = 0);
+    // Cancels what is still queued and waits for running packages.
+    ~Installer();
+    Installer(const Installer&) = delete;
+    Installer& operator=(const Installer&) = delete;
+
+    // Throws std::invalid_argument for a relocation rule whose FROM is shorter
+    // than 2 bytes.
+    InstallHandle submit(const std::vector<std::filesystem::path>& packages, const std::filesystem::path& out_dir,
+                         InstallOptions options = {});
+
+    static Installer& shared();
+    int threads() const { return static_cast<int>(workers_.size()); }
+
+private:
+    void work();
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<InstallJob>> active_;  // jobs with packages left to hand out
+    std::vector<std::thread> workers_;
+    bool stop_ = false;
+};
@@ -0,0 +1,215 @@
+// io_shim.h
+// Injectable I/O fault and latency layer for the parallel simulator. It sits
+// under the open, read and write calls of the install loop and can add
+// latency, per-path slow spots, a shared bandwidth cap and transient errors,
+// so slow-NFS and degraded-disk conditions can be reproduced on a local disk.
+// Every decision is a pure function of the seed and the operation (kind,
+// path, offset, attempt), so a run injects the same faults whatever the
+// thread interleaving.
+//
+// Options:
+//   --io-seed N            seed for all injected behaviour (default 1)
+//   --io-latency DIST      per-operation latency in microseconds:
+//                          fixed:A, uniform:A:B, exp:MEAN or pareto:MIN:ALPHA
+//   --io-slow SUBSTR:X     multiply latency by X for paths containing SUBSTR
+//                          (repeatable)
+//   --io-bandwidth MBPS    cap on read+write throughput shared by all threads
+//   --io-error-rate P      probability that an operation fails with EIO or
+//                          EAGAIN
+//   --io-retries N         retries for a transient error before giving up
+//                          (default 3)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class IoOp { Open = 1, Read = 2, Write = 3 };
+
+struct IoSlowSpot {
+    std::string substr;
+    double factor = 1;
+};
+
+struct IoShimConfig {
+    uint64_t seed = 1;
+    std::string dist;  // empty (no latency), "fixed", "uniform", "exp" or "pareto"
+    double a = 0, b = 0;
+    std::vector<IoSlowSpot> slow;
+    double bandwidth = 0;  // bytes per second, 0 = unlimited
+    double error_rate = 0;
+    int retries = 3;
+
+    bool enabled() const { return !dist.empty() || !slow.empty() || bandwidth > 0 || error_rate > 0; }
+};
+
+struct IoShimStats {
+    std::atomic<uint64_t> ops{0};
+    std::atomic<uint64_t> delay_us{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> failures{0};  // errors still failing after all retries
+};
+
+inline IoShimConfig g_io_shim;
+inline IoShimStats g_io_shim_stats;
+
+// splitmix64 finaliser: turns a key into a well-mixed 64-bit value.
+inline uint64_t io_shim_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform value in [0, 1) for the given operation and draw index.
+inline double io_shim_uniform(uint64_t key, uint64_t draw) {
+    return (io_shim_mix(key ^ io_shim_mix(draw)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Parses one --io-* option at argv[i], advancing i past its value. Returns 1
+// if consumed, 0 if not an I/O shim option, -1 (after printing) on bad input.
+inline int io_shim_parse_option(int& i, int argc, char** argv) {
+    std::string a = argv[i];
+    if (a.rfind("--io-", 0) != 0) return 0;
+    if (i + 1 >= argc) {
+        std::cerr << "Error: " << a << " needs a value\n";
+        return -1;
+    }
+    std::string v = argv[++i];
+    IoShimConfig& c = g_io_shim;
+    char* end = nullptr;
+    if (a == "--io-latency") {
+        size_t colon = v.find(':');
+        c.dist = v.substr(0, colon);
+        const char* p = colon == std::string::npos ? "" : v.c_str() + colon + 1;
+        c.a = std::strtod(p, &end);
+        c.b = *end == ':' ? std::strtod(end + 1, &end) : 0;
+        bool two = c.dist == "uniform" || c.dist == "pareto";
+        if ((c.dist != "fixed" && c.dist != "exp" && !two) || end == p || *end != '\0' ||
+            (two && c.b <= 0) || c.a < 0) {
+            std::cerr << "Error: --io-latency expects fixed:A, uniform:A:B, exp:MEAN or pareto:MIN:ALPHA\n";
+            return -1;
+        }
+        return 1;
+    }
+    if (a == "--io-slow") {
+        size_t colon = v.rfind(':');
+        double f = colon == std::string::npos ? 0 : std::strtod(v.c_str() + colon + 1, &end);
+        if (colon == 0 || colon == std::string::npos || *end != '\0' || f <= 0) {
+            std::cerr << "Error: --io-slow expects SUBSTR:FACTOR\n";
+            return -1;
+        }
+        c.slow.push_back({v.substr(0, colon), f});
+        return 1;
+    }
+    double d = std::strtod(v.c_str(), &end);
+    if (*end != '\0' || d < 0) {
+        std::cerr << "Error: " << a << " expects a non-negative number\n";
+        return -1;
+    }
+    if (a == "--io-seed") c.seed = static_cast<uint64_t>(d);
+    else if (a == "--io-bandwidth") c.bandwidth = d * 1e6;
+    else if (a == "--io-error-rate") c.error_rate = d;
+    else if (a == "--io-retries") c.retries = static_cast<int>(d);
+    else {
+        std::cerr << "Unknown option: " << a << "\n";
+        return -1;
+    }
+    return 1;
+}
+
+// Reserves bytes on the shared simulated device and returns how long the
+// caller must wait for them: transfers queue behind each other at the cap.
+inline double io_shim_bandwidth_wait_us(size_t bytes) {
+    static std::mutex mu;
+    static std::chrono::steady_clock::time_point busy_until;
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mu);
+    if (busy_until < now) busy_until = now;
+    busy_until += std::chrono::nanoseconds(static_cast<int64_t>(bytes * 1e9 / g_io_shim.bandwidth));
+    return std::chrono::duration<double, std::micro>(busy_until - now).count();
+}
+
+// Injected delay that the last cancelled operation on this thread skipped,
+// so a hedged read can still account for how long it would have taken.
+inline thread_local double g_io_shim_skipped_us = 0;
+
+// Sleeps for us microseconds, waking early if *cancel becomes true. Returns
+// false if cancelled.
+inline bool io_shim_sleep(double us, const std::atomic<bool>* cancel) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(static_cast<int64_t>(us));
+    if (!cancel) {
+        std::this_thread::sleep_until(until);
+        return true;
+    }
+    for (;;) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= until) return true;
+        if (*cancel) {
+            g_io_shim_skipped_us = std::chrono::duration<double, std::micro>(until - now).count();
+            return false;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(until - now, std::chrono::milliseconds(1)));
+    }
+}
+
+// Called before each shimmed operation. Sleeps for the injected latency and
+// bandwidth delay, then returns 0 to let the operation run, or an errno value
+// (EIO or EAGAIN) that the caller must treat as the operation's result. A
+// duplicate of an operation (hedged read) passes its lane so it draws its own
+// latency; if *cancel is set during the delay, ECANCELED is returned.
+inline int io_shim_before(IoOp op, const char* path, uint64_t offset, size_t bytes, int attempt,
+                          int lane = 0, const std::atomic<bool>* cancel = nullptr) {
+    const IoShimConfig& c = g_io_shim;
+    if (!c.enabled()) return 0;
+    uint64_t key = io_shim_mix(c.seed);
+    for (const char* p = path; *p; ++p) key = io_shim_mix(key ^ static_cast<unsigned char>(*p));
+    key = io_shim_mix(key ^ (static_cast<uint64_t>(op) << 56) ^ offset);
+    key = io_shim_mix(key ^ static_cast<uint64_t>(attempt));
+    if (lane) key = io_shim_mix(key ^ (static_cast<uint64_t>(lane) << 48));
+
+    double us = 0;
+    double u = io_shim_uniform(key, 1);
+    if (c.dist == "fixed") us = c.a;
+    else if (c.dist == "uniform") us = c.a + (c.b - c.a) * u;
+    else if (c.dist == "exp") us = -c.a * std::log(1 - u);
+    else if (c.dist == "pareto") us = c.a / std::pow(1 - u, 1 / c.b);
+    for (const auto& s : c.slow) {
+        if (std::strstr(path, s.substr.c_str())) us *= s.factor;
+    }
+    if (c.bandwidth > 0 && bytes > 0) us += io_shim_bandwidth_wait_us(bytes);
+
+    g_io_shim_stats.ops++;
+    if (us >= 1) {
+        g_io_shim_stats.delay_us += static_cast<uint64_t>(us);
+        if (!io_shim_sleep(us, cancel)) return ECANCELED;
+    }
+    if (c.error_rate > 0 && io_shim_uniform(key, 2) < c.error_rate) {
+        g_io_shim_stats.errors++;
+        return io_shim_uniform(key, 3) < 0.5 ? EIO : EAGAIN;
+    }
+    return 0;
+}
+
+// Transient errors are retried by the engine; anything else is final.
+inline bool io_shim_retryable(int err) {
+    return err == EIO || err == EAGAIN || err == EINTR;
+}
+
+// Sleeps before retry number attempt (1-based): 100 us, doubling each time.
+inline void io_shim_backoff(int attempt) {
+    g_io_shim_stats.retries++;
+    std::this_thread::sleep_for(std::chrono::microseconds(100L << std::min(attempt - 1, 10)));
+}
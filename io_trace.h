@@ -0,0 +1,174 @@
+// io_trace.h
+// Binary I/O trace format, written by bun_parallel --record-trace and read by
+// trace_replay. A trace captures every file operation issued while installing
+// (open, read, write, close, stat, mkdir, fsync) with its path, offset, size,
+// duration, result, thread and start time, so production access patterns can
+// be replayed without the original package data.
+//
+// Layout (little-endian):
+//   header:  "BTR1"  u32 record_size (32)  u64 path_table_offset
+//   records: TraceRecord, record_size bytes each, grouped in per-thread chunks
+//            (sort by t_ns to get the global order)
+//   paths:   u32 count, then count x (u32 length, bytes); a record's path_id
+//            indexes this table
+// The path table is written last, once every path is known, and the header is
+// patched to point at it.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class TraceOp : uint8_t { Open = 1, Read, Write, Close, Stat, Mkdir, Fsync };
+
+inline const char* trace_op_name(TraceOp op) {
+    static const char* names[] = {"?", "open", "read", "write", "close", "stat", "mkdir", "fsync"};
+    unsigned i = static_cast<unsigned>(op);
+    return i < sizeof(names) / sizeof(names[0]) ? names[i] : "?";
+}
+
+struct TraceRecord {
+    uint64_t t_ns;     // start time, relative to the start of the trace
+    uint64_t offset;   // file offset; open flags for TraceOp::Open
+    uint32_t size;     // bytes requested (read/write)
+    uint32_t dur_us;   // how long the operation took
+    uint32_t path_id;
+    uint16_t thread;   // OpenMP thread number of the issuer
+    uint8_t op;        // TraceOp
+    uint8_t err;       // errno of a failed operation, 0 on success
+};
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must stay 32 bytes");
+
+// Collects records into one buffer per thread, so recording takes no lock
+// except to intern a path the first time it is seen, and writes them out in
+// chunks. Thread numbers outside [0, threads) share a locked spill buffer.
+class TraceRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    bool open(const std::string& path, int threads) {
+        f_ = std::fopen(path.c_str(), "wb");
+        if (!f_) return false;
+        char header[16] = {'B', 'T', 'R', '1'};
+        uint32_t rs = sizeof(TraceRecord);
+        std::memcpy(header + 4, &rs, 4);
+        std::fwrite(header, 1, sizeof(header), f_);
+        buffers_.resize(threads + 1);
+        t0_ = Clock::now();
+        return true;
+    }
+
+    Clock::time_point start() const { return t0_; }
+
+    void record(TraceOp op, const char* path, uint64_t offset, uint64_t size,
+                Clock::time_point began, int err, int thread) {
+        TraceRecord r;
+        r.t_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(began - t0_).count());
+        r.offset = offset;
+        r.size = static_cast<uint32_t>(size > UINT32_MAX ? UINT32_MAX : size);
+        r.dur_us = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - began).count());
+        r.thread = static_cast<uint16_t>(thread);
+        r.op = static_cast<uint8_t>(op);
+        r.err = static_cast<uint8_t>(err > 255 ? 255 : err);
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            auto it = ids_.find(path);
+            if (it == ids_.end()) {
+                it = ids_.emplace(path, static_cast<uint32_t>(paths_.size())).first;
+                paths_.push_back(path);
+            }
+            r.path_id = it->second;
+        }
+        bool spill = thread < 0 || thread + 1 >= static_cast<int>(buffers_.size());
+        if (spill) {
+            std::lock_guard<std::mutex> lock(mu_);
+            push(buffers_.back(), r);
+        } else {
+            push(buffers_[thread], r);
+        }
+    }
+
+    // Flushes every buffer and writes the path table. Must be called once all
+    // recording threads are done.
+    uint64_t close() {
+        if (!f_) return 0;
+        for (auto& b : buffers_) write_chunk(b);
+        uint64_t table = static_cast<uint64_t>(std::ftell(f_));
+        uint32_t count = static_cast<uint32_t>(paths_.size());
+        std::fwrite(&count, 4, 1, f_);
+        for (const auto& p : paths_) {
+            uint32_t len = static_cast<uint32_t>(p.size());
+            std::fwrite(&len, 4, 1, f_);
+            std::fwrite(p.data(), 1, len, f_);
+        }
+        std::fseek(f_, 8, SEEK_SET);
+        std::fwrite(&table, 8, 1, f_);
+        std::fclose(f_);
+        f_ = nullptr;
+        return records_;
+    }
+
+private:
+    static constexpr size_t kChunk = 4096;  // records per buffered chunk
+
+    void push(std::vector<TraceRecord>& b, const TraceRecord& r) {
+        b.push_back(r);
+        if (b.size() >= kChunk) {
+            std::lock_guard<std::mutex> lock(file_mu_);
+            write_chunk(b);
+        }
+    }
+
+    void write_chunk(std::vector<TraceRecord>& b) {
+        std::fwrite(b.data(), sizeof(TraceRecord), b.size(), f_);
+        records_ += b.size();
+        b.clear();
+    }
+
+    std::FILE* f_ = nullptr;
+    std::mutex mu_, file_mu_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<std::string> paths_;
+    std::vector<std::vector<TraceRecord>> buffers_;
+    Clock::time_point t0_;
+    uint64_t records_ = 0;
+};
+
+// Loads a whole trace. Returns false if the file is not a complete trace.
+inline bool trace_load(const std::string& path, std::vector<TraceRecord>& records,
+                       std::vector<std::string>& paths) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char header[16];
+    uint32_t rs = 0;
+    uint64_t table = 0;
+    bool ok = std::fread(header, 1, 16, f) == 16 && std::memcmp(header, "BTR1", 4) == 0;
+    if (ok) {
+        std::memcpy(&rs, header + 4, 4);
+        std::memcpy(&table, header + 8, 8);
+        ok = rs == sizeof(TraceRecord) && table >= 16 && (table - 16) % rs == 0;
+    }
+    if (ok) {
+        records.resize((table - 16) / rs);
+        ok = std::fread(records.data(), rs, records.size(), f) == records.size();
+    }
+    uint32_t count = 0;
+    ok = ok && std::fread(&count, 4, 1, f) == 1;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        uint32_t len;
+        ok = std::fread(&len, 4, 1, f) == 1;
+        std::string p(ok ? len : 0, '\0');
+        ok = ok && std::fread(&p[0], 1, len, f) == len;
+        paths.push_back(std::move(p));
+    }
+    std::fclose(f);
+    for (const auto& r : records) ok = ok && r.path_id < paths.size();
+    return ok;
+}
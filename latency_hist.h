@@ -0,0 +1,62 @@
+// latency_hist.h
+// Lock-free log-linear latency histogram in the style of HdrHistogram. Values
+// (in whatever unit the caller picks, e.g. microseconds) are counted in 8
+// sub-buckets per power of two, so any recorded value is reported within 12.5%
+// of its true size whatever its magnitude, in a fixed 4 KiB of counters.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct LatencyHist {
+    static constexpr int kSub = 8;  // sub-buckets per power of two
+    static constexpr int kBuckets = 62 * kSub;
+
+    std::atomic<uint64_t> counts[kBuckets] = {};
+    std::atomic<uint64_t> total{0};
+
+    // Values below kSub get a bucket each; above that, the top four bits of
+    // the value pick the bucket.
+    static int bucket(uint64_t v) {
+        if (v < kSub) return static_cast<int>(v);
+        int e = 63 - __builtin_clzll(v);
+        return (e - 2) * kSub + static_cast<int>((v >> (e - 3)) & (kSub - 1));
+    }
+
+    // Smallest value that falls into bucket b.
+    static uint64_t lower(int b) {
+        if (b < kSub) return static_cast<uint64_t>(b);
+        int e = b / kSub + 2;
+        return static_cast<uint64_t>(kSub + b % kSub) << (e - 3);
+    }
+
+    void add(uint64_t v) {
+        counts[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Adds another histogram's counts, e.g. to merge per-thread histograms.
+    void merge(const LatencyHist& o) {
+        for (int b = 0; b < kBuckets; ++b) {
+            uint64_t c = o.counts[b].load(std::memory_order_relaxed);
+            if (c) counts[b].fetch_add(c, std::memory_order_relaxed);
+        }
+        total.fetch_add(o.total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // Value at percentile p (0-100), reported as the top of its bucket so it
+    // never understates the tail. Returns 0 for an empty histogram.
+    uint64_t value_at(double p) const {
+        uint64_t n = total.load(std::memory_order_relaxed);
+        if (n == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * n + 0.5);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < kBuckets; ++b) {
+            seen += counts[b].load(std::memory_order_relaxed);
+            if (seen >= rank) return b + 1 < kBuckets ? lower(b + 1) - 1 : lower(b);
+        }
+        return lower(kBuckets - 1);
+    }
+};
@@ -0,0 +1,94 @@
+// ledger_reorder.h
+// Reorder buffer for the install ledger. Workers finish packages in any order;
+// each hands its ledger record to complete() under its position in the
+// package list, and the buffer writes records out in list order as soon as a
+// contiguous prefix is done. The ledger is then the same from run to run
+// without ordering the workers themselves.
+//
+// At most `window` records wait beyond the next one due. A worker whose
+// record would exceed that waits for the prefix to move, but only while the
+// package holding the prefix back is already running: with a schedule that
+// hands packages out of list order (--lpt) it may not have started yet, and
+// waiting for it could stall every worker, so the record is buffered instead.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class LedgerReorder {
+public:
+    // sink receives one or more whole records, in list order.
+    using Sink = std::function<void(const std::string& records)>;
+
+    void reset(size_t items, size_t window, Sink sink) {
+        std::lock_guard<std::mutex> lock(mu_);
+        started_.assign(items, 0);
+        pending_.clear();
+        next_ = 0;
+        window_ = window ? window : 1;
+        sink_ = std::move(sink);
+        peak_ = 0;
+        stalls_ = 0;
+        stalled_seconds_ = 0;
+    }
+
+    // Item i was handed to a worker.
+    void start(size_t i) {
+        std::lock_guard<std::mutex> lock(mu_);
+        started_[i] = 1;
+    }
+
+    // Records item i; an empty record (a failed package) only moves the
+    // prefix, and a second record for the same item is dropped. Returns the
+    // seconds spent waiting for the lock or the window.
+    double complete(size_t i, std::string record) {
+        auto began = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mu_);
+        const bool stall = i >= next_ + window_ && !may_buffer();
+        if (stall) {
+            stalls_++;
+            cv_.wait(lock, [&] { return i < next_ + window_ || may_buffer(); });
+        }
+        double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        if (stall) stalled_seconds_ += waited;
+        if (i < next_) return waited;  // already recorded; the first record stands
+        pending_.emplace(i, std::move(record));
+        if (pending_.size() > peak_) peak_ = pending_.size();
+
+        std::string out;
+        const size_t head = next_;
+        for (auto it = pending_.begin(); it != pending_.end() && it->first == next_; it = pending_.erase(it)) {
+            out += it->second;
+            next_++;
+        }
+        if (!out.empty()) sink_(out);
+        if (next_ != head) cv_.notify_all();
+        return waited;
+    }
+
+    size_t peak() const { return peak_; }
+    size_t stalls() const { return stalls_; }
+    double stalled_seconds() const { return stalled_seconds_; }
+
+private:
+    // Waiting is only safe while the package at the head is running.
+    bool may_buffer() const { return next_ < started_.size() && !started_[next_]; }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<char> started_;
+    std::map<size_t, std::string> pending_;
+    size_t next_ = 0;
+    size_t window_ = 1;
+    Sink sink_;
+    size_t peak_ = 0;
+    size_t stalls_ = 0;
+    double stalled_seconds_ = 0;
+};
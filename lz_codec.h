@@ -0,0 +1,95 @@
+// lz_codec.h
+// A small LZ77 block codec shared by the simulators: parallel.cpp uses it for
+// .bpk archives, and both binaries use it as a workload kernel (workload.h).
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// The codec is in the style of LZ4, so nothing outside the standard library is
+// needed. A block is a run of sequences, each a token byte (high nibble:
+// literal count, low nibble: match length - 4, 15 meaning "more bytes follow,
+// 255 at a time"), the literals, then a 2-byte little-endian match offset and
+// any extra length bytes. The last sequence stops after its literals.
+inline void lz_put_length(std::vector<char>& out, size_t len) {
+    for (; len >= 255; len -= 255) out.push_back(static_cast<char>(255));
+    out.push_back(static_cast<char>(len));
+}
+
+inline void lz_put_sequence(std::vector<char>& out, const char* lit, size_t lit_len,
+                            size_t offset, size_t match_len) {
+    size_t m = match_len ? match_len - 4 : 0;
+    out.push_back(static_cast<char>((std::min<size_t>(lit_len, 15) << 4) | std::min<size_t>(m, 15)));
+    if (lit_len >= 15) lz_put_length(out, lit_len - 15);
+    out.insert(out.end(), lit, lit + lit_len);
+    if (!match_len) return;
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (m >= 15) lz_put_length(out, m - 15);
+}
+
+// Appends the compressed form of src[0, n) to out.
+inline void lz_compress(const char* src, size_t n, std::vector<char>& out) {
+    constexpr int kHashBits = 14;
+    std::vector<uint32_t> table(1u << kHashBits, 0);  // position + 1, 0 = empty
+    size_t anchor = 0, i = 0;
+    while (i + 4 <= n) {
+        uint32_t seq;
+        std::memcpy(&seq, src + i, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - kHashBits);
+        size_t cand = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+        uint32_t prev;
+        if (cand == 0 || i - (cand - 1) > 65535 || (std::memcpy(&prev, src + cand - 1, 4), prev != seq)) {
+            ++i;
+            continue;
+        }
+        --cand;
+        size_t m = 4;
+        while (i + m < n && src[cand + m] == src[i + m]) ++m;
+        lz_put_sequence(out, src + anchor, i - anchor, i - cand, m);
+        i += m;
+        anchor = i;
+    }
+    lz_put_sequence(out, src + anchor, n - anchor, 0, 0);
+}
+
+// Decompresses a block into dst, which must hold exactly raw bytes. Returns
+// false on malformed input instead of reading or writing out of bounds.
+inline bool lz_decompress(const char* src, size_t n, char* dst, size_t raw) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* end = ip + n;
+    size_t op = 0;
+    auto get_length = [&](size_t len) -> size_t {
+        if (len != 15) return len;
+        unsigned char b;
+        do {
+            if (ip == end) return SIZE_MAX;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return len;
+    };
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t lit = get_length(token >> 4);
+        if (lit > static_cast<size_t>(end - ip) || lit > raw - op) return false;
+        if (lit) std::memcpy(dst + op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end) break;
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t m = get_length(token & 15);
+        if (m == SIZE_MAX) return false;
+        m += 4;
+        if (offset == 0 || offset > op || m > raw - op) return false;
+        for (size_t k = 0; k < m; ++k, ++op) dst[op] = dst[op - offset];  // may overlap
+    }
+    return op == raw;
+}
@@ -0,0 +1,139 @@
+// merkle.h
+// File checksums and the Merkle trees built from them, shared by the
+// simulators: parallel.cpp and coro_install.cpp record the same roots in
+// install_db.txt and install_merkle.txt, so their installs can be compared
+// with `bun_parallel --compare`.
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// A simple CPU-bound function to simulate processing file contents.
+inline uint64_t checksum_bytes(const std::vector<char>& data) {
+    // FNV-1a hash algorithm (64-bit)
+    uint64_t h = 1469598103934665603ULL;
+    for (char c : data) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Continues an FNV-1a hash over n more bytes. Used to build Merkle nodes from
+// names and child hashes with the same function as checksum_bytes.
+inline uint64_t fnv1a_update(uint64_t h, const void* p, size_t n) {
+    const unsigned char* b = static_cast<const unsigned char*>(p);
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Leaf hash of a Merkle tree: binds a name (file or package) to its hash.
+inline uint64_t merkle_leaf(const std::string& name, uint64_t hash) {
+    uint64_t h = fnv1a_update(1469598103934665603ULL, name.data(), name.size());
+    return fnv1a_update(h, &hash, sizeof(hash));
+}
+
+// Builds a binary Merkle tree over leaves (already in name order) and returns
+// all levels, leaves first and the single root last. An odd node is promoted
+// unchanged. An empty tree has a root of 0.
+inline std::vector<std::vector<uint64_t>> merkle_levels(std::vector<uint64_t> leaves) {
+    std::vector<std::vector<uint64_t>> levels;
+    if (leaves.empty()) leaves.push_back(0);
+    levels.push_back(std::move(leaves));
+    while (levels.back().size() > 1) {
+        const auto& cur = levels.back();
+        std::vector<uint64_t> next;
+        for (size_t i = 0; i < cur.size(); i += 2) {
+            if (i + 1 == cur.size()) {
+                next.push_back(cur[i]);
+            } else {
+                uint64_t pair[2] = {cur[i], cur[i + 1]};
+                next.push_back(fnv1a_update(1469598103934665603ULL, pair, sizeof(pair)));
+            }
+        }
+        levels.push_back(std::move(next));
+    }
+    return levels;
+}
+
+inline uint64_t merkle_root(std::vector<uint64_t> leaves) {
+    return merkle_levels(std::move(leaves)).back()[0];
+}
+
+inline std::string hex64(uint64_t v) {
+    std::ostringstream os;
+    os << std::hex << std::setw(16) << std::setfill('0') << v;
+    return os.str();
+}
+
+// Parses a whole field of hex digits, as hex64 writes it. Returns false for
+// anything else, such as a line truncated mid-hash or edited by hand.
+inline bool parse_hex64(const std::string& s, uint64_t& v) {
+    const char* end = s.data() + s.size();
+    auto [ptr, ec] = std::from_chars(s.data(), end, v, 16);
+    return ec == std::errc() && ptr == end && !s.empty();
+}
+
+// Returns the latest Merkle root recorded in the ledger for each package.
+// Lines written before roots were recorded, and lines whose root does not
+// parse, are ignored.
+inline std::map<std::string, uint64_t> read_ledger_roots(const std::filesystem::path& out_dir) {
+    std::map<std::string, uint64_t> roots;
+    std::ifstream db(out_dir / "install_db.txt");
+    std::string line;
+    while (std::getline(db, line)) {
+        size_t at = line.rfind(" merkle=");
+        if (at == std::string::npos) continue;
+        uint64_t root;
+        if (parse_hex64(line.substr(at + 8), root)) roots[line.substr(0, line.find(' '))] = root;
+    }
+    return roots;
+}
+
+// Writes out_dir/install_merkle.txt: the whole-install root on the first line,
+// then one "<package> <root>" line per package in name order. Comparing two
+// installs only needs the first line.
+inline void write_install_merkle(const std::filesystem::path& out_dir) {
+    auto roots = read_ledger_roots(out_dir);
+    std::vector<uint64_t> leaves;
+    for (const auto& [name, root] : roots) leaves.push_back(merkle_leaf(name, root));
+    uint64_t install_root = merkle_root(std::move(leaves));
+
+    std::filesystem::path tmp = out_dir / ".install_merkle.txt.tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << "root " << hex64(install_root) << "\n";
+        for (const auto& [name, root] : roots) out << name << " " << hex64(root) << "\n";
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, out_dir / "install_merkle.txt", ec);
+}
+
+// Reads an install_merkle.txt. Without a packages vector, stops after the root
+// line. Returns false if the file is missing or any hash in it is malformed.
+inline bool read_install_merkle(const std::filesystem::path& out_dir, uint64_t& root,
+                                std::vector<std::pair<std::string, uint64_t>>* packages) {
+    std::ifstream in(out_dir / "install_merkle.txt");
+    std::string key, value;
+    if (!(in >> key >> value) || key != "root" || !parse_hex64(value, root)) return false;
+    uint64_t v;
+    while (packages && in >> key >> value) {
+        if (!parse_hex64(value, v)) return false;
+        packages->emplace_back(key, v);
+    }
+    return true;
+}
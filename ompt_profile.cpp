@@ -0,0 +1,266 @@
+// ompt_profile.cpp
+// OMPT tool that profiles the OpenMP runtime underneath bun_parallel: parallel
+// regions, implicit tasks, work-chunk dispatch of the package loop, waits at
+// implicit barriers, and acquire/release of the critical sections such as the
+// one around sync_print. At exit it prints, per thread and in total, how much
+// wall time went to chunks, barrier waits and lock waits, so the runtime's own
+// overhead for schedule(dynamic, 1) can be told apart from package work. The
+// ledger's reorder-window waits happen outside the OpenMP runtime and are not
+// seen here; --stragglers and the ledger window summary report them.
+//
+// OMPT is implemented by the LLVM OpenMP runtime (libomp), not by GCC's
+// libgomp. A g++-built bun_parallel runs on libomp through its libgomp
+// compatible entry points, so no rebuild is needed:
+//
+// Compile: g++ -O2 -std=c++17 -shared -fPIC -I<dir of omp-tools.h> ompt_profile.cpp -o libompt_profile.so
+//          (Debian: -I/usr/lib/llvm-14/lib/clang/14.0.6/include)
+// Usage: LD_PRELOAD=<libomp.so> OMP_TOOL_LIBRARIES=./libompt_profile.so ./bun_parallel ...
+//          (Debian: LD_PRELOAD=/usr/lib/llvm-14/lib/libomp.so.5)
+//
+// The report goes to stderr. Events the runtime does not deliver (older libomp
+// releases have no dispatch callback) are reported as unavailable.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <vector>
+#include <omp-tools.h>
+
+namespace {
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Everything recorded for one OS thread. Only the owning thread writes it;
+// the report is printed after the runtime has shut its threads down.
+struct ThreadProfile {
+    int index = -1;  // last OpenMP thread number seen in a team
+    uint64_t regions = 0;        // parallel regions this thread took part in
+    uint64_t task_ns = 0;        // inside implicit tasks
+    uint64_t loop_ns = 0;        // inside worksharing loops
+    uint64_t loops = 0;
+    uint64_t chunks = 0;         // dispatched chunks (iterations for dynamic,1)
+    uint64_t chunk_ns = 0;       // dispatch to next dispatch or loop end
+    uint64_t barrier_ns = 0;     // waiting at implicit barriers
+    uint64_t barriers = 0;
+    uint64_t lock_waits = 0;     // critical/lock acquisitions
+    uint64_t lock_wait_ns = 0;   // acquire to acquired
+    uint64_t lock_hold_ns = 0;   // acquired to released
+    uint64_t contended = 0;      // acquisitions that waited over 1 us
+
+    uint64_t task_begin = 0, loop_begin = 0, chunk_begin = 0, barrier_begin = 0;
+    uint64_t lock_begin = 0, lock_acquired = 0;
+};
+
+// Heap-allocated and never freed: the runtime calls finalize after this
+// library's static destructors have run.
+std::mutex& g_mu = *new std::mutex;
+std::vector<ThreadProfile*>& g_threads = *new std::vector<ThreadProfile*>;
+std::atomic<uint64_t> g_region_ns{0};
+std::atomic<uint64_t> g_regions{0};
+std::atomic<uint64_t> g_team_ns{0};  // region wall time x team size
+bool g_have_dispatch = false;
+uint64_t g_start = 0;
+
+ThreadProfile& me() {
+    thread_local ThreadProfile* p = [] {
+        auto* t = new ThreadProfile;
+        std::lock_guard<std::mutex> lock(g_mu);
+        g_threads.push_back(t);
+        return t;
+    }();
+    return *p;
+}
+
+// The region's start time and team size travel in parallel_data.
+struct RegionInfo {
+    uint64_t begin;
+    unsigned team;
+};
+
+void on_parallel_begin(ompt_data_t*, const ompt_frame_t*, ompt_data_t* parallel_data,
+                       unsigned requested, int, const void*) {
+    parallel_data->ptr = new RegionInfo{now_ns(), requested};
+}
+
+void on_parallel_end(ompt_data_t* parallel_data, ompt_data_t*, int, const void*) {
+    auto* r = static_cast<RegionInfo*>(parallel_data->ptr);
+    if (!r) return;
+    uint64_t ns = now_ns() - r->begin;
+    g_region_ns += ns;
+    g_team_ns += ns * r->team;
+    g_regions++;
+    delete r;
+    parallel_data->ptr = nullptr;
+}
+
+void on_implicit_task(ompt_scope_endpoint_t endpoint, ompt_data_t* parallel_data, ompt_data_t*,
+                      unsigned actual, unsigned index, int flags) {
+    if (flags & ompt_task_initial) return;
+    ThreadProfile& t = me();
+    if (endpoint == ompt_scope_begin) {
+        t.index = static_cast<int>(index);
+        t.task_begin = now_ns();
+        t.regions++;
+        // The actual team can be smaller than requested.
+        auto* r = parallel_data ? static_cast<RegionInfo*>(parallel_data->ptr) : nullptr;
+        if (r && index == 0) r->team = actual;
+    } else if (t.task_begin) {
+        t.task_ns += now_ns() - t.task_begin;
+        t.task_begin = 0;
+    }
+}
+
+void on_work(ompt_work_t wstype, ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*,
+             uint64_t, const void*) {
+    if (wstype != ompt_work_loop) return;
+    ThreadProfile& t = me();
+    uint64_t now = now_ns();
+    if (endpoint == ompt_scope_begin) {
+        t.loop_begin = now;
+        t.loops++;
+    } else {
+        if (t.chunk_begin) t.chunk_ns += now - t.chunk_begin;
+        t.chunk_begin = 0;
+        if (t.loop_begin) t.loop_ns += now - t.loop_begin;
+        t.loop_begin = 0;
+    }
+}
+
+void on_dispatch(ompt_data_t*, ompt_data_t*, ompt_dispatch_t kind, ompt_data_t) {
+    if (kind != ompt_dispatch_iteration) return;
+    ThreadProfile& t = me();
+    uint64_t now = now_ns();
+    if (t.chunk_begin) t.chunk_ns += now - t.chunk_begin;
+    t.chunk_begin = now;
+    t.chunks++;
+}
+
+bool is_implicit_barrier(ompt_sync_region_t kind) {
+    return kind == ompt_sync_region_barrier_implicit || kind == ompt_sync_region_barrier_implicit_workshare ||
+           kind == ompt_sync_region_barrier_implicit_parallel || kind == ompt_sync_region_barrier_implementation;
+}
+
+void on_sync_wait(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t*, ompt_data_t*,
+                  const void*) {
+    if (!is_implicit_barrier(kind)) return;
+    ThreadProfile& t = me();
+    if (endpoint == ompt_scope_begin) {
+        t.barrier_begin = now_ns();
+    } else if (t.barrier_begin) {
+        t.barrier_ns += now_ns() - t.barrier_begin;
+        t.barrier_begin = 0;
+        t.barriers++;
+    }
+}
+
+void on_mutex_acquire(ompt_mutex_t, unsigned, unsigned, ompt_wait_id_t, const void*) {
+    me().lock_begin = now_ns();
+}
+
+void on_mutex_acquired(ompt_mutex_t, ompt_wait_id_t, const void*) {
+    ThreadProfile& t = me();
+    t.lock_acquired = now_ns();
+    if (t.lock_begin) {
+        uint64_t wait = t.lock_acquired - t.lock_begin;
+        t.lock_wait_ns += wait;
+        t.contended += wait > 1000;
+        t.lock_waits++;
+    }
+    t.lock_begin = 0;
+}
+
+void on_mutex_released(ompt_mutex_t, ompt_wait_id_t, const void*) {
+    ThreadProfile& t = me();
+    if (t.lock_acquired) t.lock_hold_ns += now_ns() - t.lock_acquired;
+    t.lock_acquired = 0;
+}
+
+double ms(uint64_t ns) { return ns / 1e6; }
+
+int initialize(ompt_function_lookup_t lookup, int, ompt_data_t*) {
+    auto set_callback = reinterpret_cast<ompt_set_callback_t>(lookup("ompt_set_callback"));
+    if (!set_callback) return 0;
+    auto reg = [&](ompt_callbacks_t event, ompt_callback_t cb) {
+        return set_callback(event, cb) == ompt_set_always;
+    };
+    reg(ompt_callback_parallel_begin, reinterpret_cast<ompt_callback_t>(&on_parallel_begin));
+    reg(ompt_callback_parallel_end, reinterpret_cast<ompt_callback_t>(&on_parallel_end));
+    reg(ompt_callback_implicit_task, reinterpret_cast<ompt_callback_t>(&on_implicit_task));
+    reg(ompt_callback_work, reinterpret_cast<ompt_callback_t>(&on_work));
+    g_have_dispatch = reg(ompt_callback_dispatch, reinterpret_cast<ompt_callback_t>(&on_dispatch));
+    reg(ompt_callback_sync_region_wait, reinterpret_cast<ompt_callback_t>(&on_sync_wait));
+    reg(ompt_callback_mutex_acquire, reinterpret_cast<ompt_callback_t>(&on_mutex_acquire));
+    reg(ompt_callback_mutex_acquired, reinterpret_cast<ompt_callback_t>(&on_mutex_acquired));
+    reg(ompt_callback_mutex_released, reinterpret_cast<ompt_callback_t>(&on_mutex_released));
+    g_start = now_ns();
+    return 1;  // keep the tool active
+}
+
+// Prints the report. Fork/join is the part of each region's wall time x team
+// size that no implicit task covered: waking the team and tearing it down.
+// Dispatch is the time inside worksharing loops not covered by dispatched
+// chunks: asking the runtime for the first chunk and leaving the loop (the
+// cost of handing out each later chunk is inside the chunk interval, as OMPT
+// has no chunk-end event).
+void finalize(ompt_data_t*) {
+    std::lock_guard<std::mutex> lock(g_mu);
+    std::sort(g_threads.begin(), g_threads.end(),
+              [](const ThreadProfile* a, const ThreadProfile* b) { return a->index < b->index; });
+    ThreadProfile sum;
+    std::fprintf(stderr, "\n---------------- OMPT runtime profile ----------------\n");
+    std::fprintf(stderr, "%6s %8s %10s %8s %10s %10s %8s %10s %10s\n", "thread", "chunks", "chunk ms",
+                 "us/chunk", "loop ms", "barrier ms", "locks", "lockwt ms", "lockhd ms");
+    for (const ThreadProfile* t : g_threads) {
+        if (t->regions == 0 && t->lock_waits == 0) continue;
+        if (g_have_dispatch) {
+            std::fprintf(stderr, "%6d %8lu %10.2f %8.1f", t->index, (unsigned long)t->chunks, ms(t->chunk_ns),
+                         t->chunks ? t->chunk_ns / 1e3 / t->chunks : 0.0);
+        } else {
+            std::fprintf(stderr, "%6d %8s %10s %8s", t->index, "-", "-", "-");
+        }
+        std::fprintf(stderr, " %10.2f %10.2f %8lu %10.2f %10.2f\n", ms(t->loop_ns), ms(t->barrier_ns),
+                     (unsigned long)t->lock_waits, ms(t->lock_wait_ns), ms(t->lock_hold_ns));
+        sum.task_ns += t->task_ns;
+        sum.loop_ns += t->loop_ns;
+        sum.chunks += t->chunks;
+        sum.chunk_ns += t->chunk_ns;
+        sum.barrier_ns += t->barrier_ns;
+        sum.lock_waits += t->lock_waits;
+        sum.lock_wait_ns += t->lock_wait_ns;
+        sum.lock_hold_ns += t->lock_hold_ns;
+        sum.contended += t->contended;
+    }
+    uint64_t team = g_team_ns.load();
+    uint64_t fork_join = team > sum.task_ns ? team - sum.task_ns : 0;
+    uint64_t dispatch = sum.loop_ns > sum.chunk_ns ? sum.loop_ns - sum.chunk_ns : 0;
+    auto pct = [&](uint64_t ns) { return team ? 100.0 * ns / team : 0.0; };
+    std::fprintf(stderr, "%lu parallel regions, %.2f ms wall, %.2f thread-ms in teams (run %.2f ms).\n",
+                 (unsigned long)g_regions.load(), ms(g_region_ns.load()), ms(team), ms(now_ns() - g_start));
+    std::fprintf(stderr, "Fork/join:        %10.2f thread-ms (%5.2f%%)\n", ms(fork_join), pct(fork_join));
+    if (g_have_dispatch) {
+        std::fprintf(stderr, "Loop dispatch:    %10.2f thread-ms (%5.2f%%) outside %lu chunks\n", ms(dispatch),
+                     pct(dispatch), (unsigned long)sum.chunks);
+    } else {
+        std::fprintf(stderr, "Loop dispatch:    unavailable (this libomp has no dispatch callback)\n");
+    }
+    std::fprintf(stderr, "Implicit barriers:%10.2f thread-ms (%5.2f%%)\n", ms(sum.barrier_ns), pct(sum.barrier_ns));
+    std::fprintf(stderr, "Lock wait:        %10.2f thread-ms (%5.2f%%) over %lu acquisitions, %lu contended\n",
+                 ms(sum.lock_wait_ns), pct(sum.lock_wait_ns), (unsigned long)sum.lock_waits,
+                 (unsigned long)sum.contended);
+    std::fprintf(stderr, "Lock hold:        %10.2f thread-ms (%5.2f%%)\n", ms(sum.lock_hold_ns), pct(sum.lock_hold_ns));
+    std::fprintf(stderr, "------------------------------------------------------\n");
+}
+
+}  // namespace
+
+extern "C" ompt_start_tool_result_t* ompt_start_tool(unsigned int, const char*) {
+    static ompt_start_tool_result_t result = {&initialize, &finalize, {0}};
+    return &result;
+}
@@ -4,10 +4,53 @@
 // demonstrating speed-ups for tasks that are a mix of I/O and CPU-bound work.
 //
 // Compile: g++ -O2 -fopenmp -std=c++17 bun_sim_parallel.cpp -o bun_parallel
-// Usage: ./bun_parallel <packages_list.txt> <output_dir>
+// Usage: ./bun_parallel [--no-sparse] [--upgrade] [--snapshot] [--lazy|--background-fill] <packages_list.txt> <output_dir> [<output_dir>...]
+//   Extra output directories receive the same install; each source is read once.
+//   --no-sparse  write every byte instead of turning zero blocks into holes
+//   --upgrade    only rewrite files whose checksum differs from the installed .meta
+//   --snapshot   snapshot each output directory (reflinks or hardlinks) before installing
+//   --lazy       write only a stub index per package; contents come from --materialize
+//   --background-fill  like --lazy, then materialize everything in a background process
+//   --relocate FROM=TO  rewrite the embedded prefix FROM to TO in installed files (repeatable)
+//   --work-ns-per-kib, --work-us-per-file, --work-kernel, --work-rounds
+//                model extra CPU work per file; see workload.h
+//   --io-seed, --io-latency, --io-slow, --io-bandwidth, --io-error-rate, --io-retries
+//                inject deterministic I/O latency and faults; see io_shim.h
+//   --record-trace FILE  log every file operation of the install to FILE for trace_replay
+//   --lpt        start the packages that took longest in earlier runs first
+//   --histograms print per-file read/hash/write latency quantiles by file size
+//   --hist-out FILE  export those histograms to FILE (format in file_hist.h)
+//   --stragglers N   after the summary, list the N slowest packages and files by phase
+//   --report-json FILE, --report-label L  write a benchmark report for bench_compare
+//   --ledger-window N  hold at most N out-of-order ledger records (default 1024)
+//   --energy     report RAPL package/DRAM joules and CPU time per phase; see energy.h
+//   --sample FILE, --sample-ms N  write CPU, disk, page cache and context switch
+//                samples every N ms (default 100) as CSV; see sys_sampler.h
+//   --hedge P, --hedge-min-us N
+//                duplicate reads slower than the P-th percentile; see hedged_read.h
+// Usage: ./bun_parallel --uninstall|--prune [--trash] <packages_list.txt> <output_dir> [<output_dir>...]
+//   --uninstall  remove the listed packages; --prune removes installed packages not listed
+//   --trash      rename into <output_dir>/.trash first and delete in the background
+// Usage: ./bun_parallel --rollback <output_dir> [<output_dir>...]
+//   --rollback   swap the last snapshot back in place of the output directory
+// Usage: ./bun_parallel --compare <output_dir> <output_dir>
+//   --compare    compare two installs by their Merkle roots and list differing packages
+// Usage: ./bun_parallel --materialize <output_dir> [<package>...]
+//   --materialize  copy the contents of lazily installed packages (all if none are named)
+// Usage: ./bun_parallel --pack <packages_list.txt> <archive_dir>
+//   --pack       write each listed package as a compressed <archive_dir>/<package>.bpk
+// Usage: ./bun_parallel --calibrate <output_dir>
+//   --calibrate  measure memory, checksum and storage limits into <output_dir>/calibration.txt;
+//                installs into <output_dir> then report throughput against them
+// Usage: ./bun_parallel --extract <archive.bpk> <dir> [<entry>...]
+//        ./bun_parallel --verify-archive <archive.bpk> [<entry>...]
+//   --extract    extract entries (e.g. files/f1.bin) of an archive, all by default
+//   --verify-archive  check entries of an archive against their checksums
+// A line of packages_list.txt may name a .bpk archive instead of a package directory.
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <chrono>
 #include <filesystem>
@@ -16,103 +59,2153 @@
 #include <iomanip>
 #include <iterator>
 #include <sstream>
+#include <stdexcept>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <unordered_set>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <unistd.h>
 #include <omp.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "energy.h"
+#include "file_hist.h"
+#include "hedged_read.h"
+#include "io_shim.h"
+#include "installer.h"
+#include "io_trace.h"
+#include "ledger_reorder.h"
+#include "merkle.h"
+#include "straggler.h"
+#include "sys_sampler.h"
+#include "lz_codec.h"
+#include "workload.h"
 
 namespace fs = std::filesystem;
 using Clock = std::chrono::steady_clock;
 
 // A thread-safe print function to prevent garbled output from multiple threads.
 // Uses an OpenMP critical section to ensure only one thread prints at a time.
+// Installer pool threads set t_quiet: an embedding tool gets results, not log
+// lines on its stdout.
+thread_local bool t_quiet = false;
+
 void sync_print(const std::string& msg) {
+    if (t_quiet) return;
     #pragma omp critical
     {
         std::cout << msg << std::endl;
     }
 }
 
-// A simple CPU-bound function to simulate processing file contents.
-uint64_t checksum_bytes(const std::vector<char>& data) {
-    // FNV-1a hash algorithm (64-bit)
-    uint64_t h = 1469598103934665603ULL;
-    for (char c : data) {
-        h ^= static_cast<unsigned char>(c);
-        h *= 1099511628211ULL;
+// Granularity of hole detection in the copy path. Matches the common filesystem
+// block size; a zero run shorter than this cannot become a hole anyway.
+constexpr size_t kSparseBlock = 4096;
+
+// Run-wide copy counters, updated with omp atomics from the worker threads.
+struct CopyStats {
+    uint64_t files_read = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_written_first = 0;  // of bytes_written, to the first target
+    uint64_t bytes_sparse = 0;  // bytes left as holes instead of being written
+    uint64_t bytes_cloned = 0;  // bytes shared with a sibling target via reflink
+    uint64_t files_unchanged = 0;  // upgrade mode: files whose checksum matched
+    uint64_t files_removed = 0;    // upgrade mode: files no longer in the package
+    uint64_t files_relocated = 0;  // files whose embedded prefixes were rewritten
+    uint64_t relocations = 0;      // prefix occurrences rewritten
+    uint64_t relocations_skipped = 0;  // binary occurrences with a longer replacement
+};
+
+CopyStats g_copy_stats;
+bool g_lazy = false;
+
+// A build-time install prefix embedded in package files and what to replace it
+// with on install (--relocate FROM=TO).
+struct PrefixRule {
+    std::string from;
+    std::string to;
+};
+
+// How packages are installed. The command line fills g_install; an Installer
+// submission carries its own (InstallOptions), and a pool thread points
+// t_install at them while it installs one of the submission's packages.
+struct InstallSettings {
+    bool sparse_copy = true;
+    bool upgrade = false;
+    std::vector<PrefixRule> relocations;
+};
+
+InstallSettings g_install;
+thread_local const InstallSettings* t_install = nullptr;
+
+const InstallSettings& install_settings() { return t_install ? *t_install : g_install; }
+
+// Extra modelled CPU work per file (see workload.h). g_workload_sink keeps the
+// results live so the compiler cannot drop the work.
+WorkloadModel g_workload;
+uint64_t g_workload_sink = 0;
+// Set when a snapshot of an output directory exists, whether taken by this run
+// or an earlier one (see break_links_if_snapshot). Installed files may then
+// share an inode with the snapshot (hardlink farm), so every write replaces the
+// directory entry instead of truncating the shared inode.
+bool g_break_links = false;
+
+// Returns true if the n bytes at p are all zero. Uses SSE2 (always present on
+// x86-64) to test 64 bytes per iteration, falling back to a scalar tail.
+bool is_zero_block(const char* p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= n; i += 64) {
+        __m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 32)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 48)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) return false;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (p[i] != 0) return false;
+    }
+    return true;
+}
+
+// --histograms / --hist-out: one set of per-file phase histograms per OpenMP
+// thread, merged after the install loop. Empty when neither option is given.
+std::vector<std::unique_ptr<FileHistograms>> g_file_hists;
+
+void record_file_phase(FilePhase phase, uint64_t bytes, Clock::time_point began) {
+    size_t t = static_cast<size_t>(omp_get_thread_num());
+    if (t >= g_file_hists.size()) return;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - began).count();
+    g_file_hists[t]->record(phase, bytes, static_cast<uint64_t>(ns));
+}
+
+// --stragglers N: per-thread top-N slowest packages and files. t_open_seconds
+// accumulates time spent in io_open on each thread, so the phases that
+// contain opens can report them separately.
+std::vector<StragglerTop> g_slow_packages, g_slow_files;
+thread_local double t_open_seconds = 0;
+
+// The calling thread's share of g_copy_stats.bytes_read and bytes_written,
+// from which process_package takes each package's bytes.
+thread_local uint64_t t_bytes_read = 0;
+thread_local uint64_t t_bytes_written = 0;
+
+double seconds_since(Clock::time_point t) {
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+// --record-trace: every file operation of the install loop is logged here.
+TraceRecorder g_trace;
+bool g_tracing = false;
+
+void trace_op(TraceOp op, const fs::path& path, uint64_t offset, uint64_t size,
+              Clock::time_point began, int err) {
+    if (g_tracing) g_trace.record(op, path.c_str(), offset, size, began, err, omp_get_thread_num());
+}
+
+// The engine's I/O entry points for file data. Each call first passes through
+// the injection layer in io_shim.h (a no-op unless --io-* options are given);
+// transient errors, injected or real, are retried with backoff up to
+// --io-retries times before the error is returned. With --record-trace, each
+// call is also logged, including any injected delay.
+// A hedged read (see hedged_read.h) passes the lane of its copy and a flag
+// that is set when the other copy has already answered.
+template <typename F>
+auto io_retry(IoOp op, const fs::path& path, uint64_t offset, size_t bytes, F&& call,
+              int lane = 0, const std::atomic<bool>* cancel = nullptr) -> decltype(call()) {
+    for (int attempt = 0;; ++attempt) {
+        int err = io_shim_before(op, path.c_str(), offset, bytes, attempt, lane, cancel);
+        if (err == 0) {
+            auto r = call();
+            if (r >= 0) return r;
+            err = errno;
+        }
+        if (!io_shim_retryable(err) || attempt >= g_io_shim.retries || (cancel && *cancel)) {
+            if (io_shim_retryable(err) && !(cancel && *cancel)) g_io_shim_stats.failures++;
+            errno = err;
+            return -1;
+        }
+        io_shim_backoff(attempt + 1);
+    }
+}
+
+int io_open(const fs::path& path, int flags, mode_t mode = 0) {
+    auto began = Clock::now();
+    int fd = io_retry(IoOp::Open, path, 0, 0, [&] { return ::open(path.c_str(), flags, mode); });
+    int err = fd < 0 ? errno : 0;
+    t_open_seconds += seconds_since(began);
+    trace_op(TraceOp::Open, path, static_cast<uint64_t>(flags), 0, began, err);
+    errno = err;
+    return fd;
+}
+
+ssize_t io_pread(int fd, char* buf, size_t n, off_t offset, const fs::path& path) {
+    auto began = Clock::now();
+    ssize_t r;
+    if (g_hedge.enabled()) {
+        r = hedged_pread(fd, buf, n, [path, n, offset](int lane, int dfd, char* dst, const std::atomic<bool>* cancel) {
+            return io_retry(IoOp::Read, path, offset, n, [&] { return ::pread(dfd, dst, n, offset); }, lane, cancel);
+        });
+    } else {
+        r = io_retry(IoOp::Read, path, offset, n, [&] { return ::pread(fd, buf, n, offset); });
+    }
+    int err = r < 0 ? errno : 0;
+    trace_op(TraceOp::Read, path, offset, n, began, err);
+    errno = err;
+    return r;
+}
+
+ssize_t io_pwrite(int fd, const char* buf, size_t n, off_t offset, const fs::path& path) {
+    auto began = Clock::now();
+    ssize_t r = io_retry(IoOp::Write, path, offset, n, [&] { return ::pwrite(fd, buf, n, offset); });
+    int err = r < 0 ? errno : 0;
+    trace_op(TraceOp::Write, path, offset, n, began, err);
+    errno = err;
+    return r;
+}
+
+int io_close(int fd, const fs::path& path) {
+    auto began = Clock::now();
+    int r = ::close(fd);
+    trace_op(TraceOp::Close, path, 0, 0, began, r < 0 ? errno : 0);
+    return r;
+}
+
+int io_fstat(int fd, struct stat* st, const fs::path& path) {
+    auto began = Clock::now();
+    int r = ::fstat(fd, st);
+    trace_op(TraceOp::Stat, path, 0, 0, began, r < 0 ? errno : 0);
+    return r;
+}
+
+// Reads a whole file into buf. Holes reported by SEEK_DATA/SEEK_HOLE are not
+// read at all; buf is zero-filled so its contents (and checksum) are identical
+// to a dense read. Returns false if the file cannot be opened or read.
+bool read_file(const fs::path& path, std::vector<char>& buf) {
+    int fd = io_open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (io_fstat(fd, &st, path) != 0) {
+        io_close(fd, path);
+        return false;
+    }
+    const off_t size = st.st_size;
+    buf.assign(static_cast<size_t>(size), 0);
+
+    off_t pos = 0;
+    bool ok = true;
+    while (pos < size) {
+        // Find the next data extent. Filesystems without hole support report
+        // the whole file as one extent; ENXIO means only a hole remains.
+        off_t data = ::lseek(fd, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;
+            data = pos;
+        }
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0 || hole > size) hole = size;
+
+        for (off_t off = data; off < hole;) {
+            ssize_t n = io_pread(fd, buf.data() + off, static_cast<size_t>(hole - off), off, path);
+            if (n <= 0) {
+                ok = n == 0;  // file shrank underneath us; keep the zero tail
+                break;
+            }
+            off += n;
+        }
+        if (!ok) break;
+        pos = hole;
+    }
+    io_close(fd, path);
+
+    #pragma omp atomic
+    g_copy_stats.bytes_read += static_cast<uint64_t>(size);
+    t_bytes_read += static_cast<uint64_t>(size);
+    return ok;
+}
+
+// Writes buf to path. With sparse copy enabled, every all-zero kSparseBlock is
+// skipped with lseek instead of written, so the filesystem leaves it as a hole;
+// a final ftruncate sets the length when the file ends in a hole. The output is
+// opened with O_TRUNC, so skipped ranges never contain stale data. Returns false
+// on any write error.
+bool write_file(const fs::path& path, const std::vector<char>& buf) {
+    if (g_break_links) ::unlink(path.c_str());
+    int fd = io_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    const size_t size = buf.size();
+    const bool sparse = install_settings().sparse_copy;
+    uint64_t written = 0, skipped = 0;
+    bool ok = true;
+    size_t off = 0;
+    while (off < size && ok) {
+        size_t len = std::min(kSparseBlock, size - off);
+        if (sparse && len == kSparseBlock && is_zero_block(buf.data() + off, len)) {
+            skipped += len;
+            off += len;
+            continue;
+        }
+        // Coalesce consecutive data blocks into one write.
+        size_t end = off + len;
+        while (end < size) {
+            size_t next = std::min(kSparseBlock, size - end);
+            if (sparse && next == kSparseBlock && is_zero_block(buf.data() + end, next)) break;
+            end += next;
+        }
+        while (off < end) {
+            ssize_t n = io_pwrite(fd, buf.data() + off, end - off, static_cast<off_t>(off), path);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            off += static_cast<size_t>(n);
+            written += static_cast<uint64_t>(n);
+        }
+    }
+    if (ok && skipped > 0 && ::ftruncate(fd, static_cast<off_t>(size)) != 0) ok = false;
+    if (io_close(fd, path) != 0) ok = false;
+
+    #pragma omp atomic
+    g_copy_stats.bytes_written += written;
+    t_bytes_written += written;
+    #pragma omp atomic
+    g_copy_stats.bytes_sparse += skipped;
+    return ok;
+}
+
+// Makes dst a reflink clone of src (FICLONE, supported by btrfs and XFS), so
+// the data is shared instead of written again. Returns false when the
+// filesystem cannot clone, in which case the caller writes the bytes itself;
+// once a filesystem has refused, later calls return false without trying.
+bool g_reflink_ok = true;  // cleared after the first unsupported FICLONE
+
+bool clone_file(const fs::path& src, const fs::path& dst) {
+    bool try_clone;
+    #pragma omp atomic read
+    try_clone = g_reflink_ok;
+    if (!try_clone) return false;
+    if (g_break_links) ::unlink(dst.c_str());
+    int sfd = io_open(src, O_RDONLY | O_CLOEXEC);
+    if (sfd < 0) return false;
+    int dfd = io_open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dfd < 0) {
+        ::close(sfd);
+        return false;
+    }
+    bool ok = ::ioctl(dfd, FICLONE, sfd) == 0;
+    if (!ok && (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY)) {
+        #pragma omp atomic write
+        g_reflink_ok = false;
+    }
+    ::close(sfd);
+    ::close(dfd);
+    if (!ok) {
+        std::error_code ec;
+        fs::remove(dst, ec);
+    }
+    return ok;
+}
+
+// Package archive (.bpk) written by --pack. All integers are little-endian.
+//   "BPK2"  u32 entry_count  u32 frame_size  u64 index_checksum
+//   entry_count index entries:
+//     u16 name_len, name, u64 raw_size, u64 checksum (checksum_bytes of the
+//     raw data), u32 frame_count, then per frame:
+//       u64 offset, u32 stored_size, u8 codec (0 stored, 1 lz)
+//   frame data at the recorded offsets
+// Every frame holds frame_size raw bytes (the last one of an entry may hold
+// fewer) and is compressed on its own, so any file, or any part of one, can
+// be read without touching the rest of the archive. The index doubles as the
+// integrity manifest: index_checksum covers the index bytes and every entry
+// carries the checksum of its uncompressed contents. Entries are
+// "manifest.json" followed by "files/<name>" in name order.
+constexpr char kPackMagic[4] = {'B', 'P', 'K', '2'};
+constexpr uint32_t kPackFrameSize = 64 * 1024;
+
+template <typename T>
+void put_le(std::vector<char>& out, T v) {
+    char b[sizeof(T)];
+    std::memcpy(b, &v, sizeof(T));
+    out.insert(out.end(), b, b + sizeof(T));
+}
+
+struct PackFrame {
+    uint64_t offset = 0;
+    uint32_t stored_size = 0;
+    uint8_t codec = 0;
+};
+
+struct PackIndexEntry {
+    std::string name;
+    uint64_t raw_size = 0;
+    uint64_t checksum = 0;
+    std::vector<PackFrame> frames;
+};
+
+// Read side of a .bpk archive. The file is mmap'd and the index parsed and
+// checked up front; entry data is only touched when a file is extracted, so
+// pulling one file out of a large archive reads just that file's frames.
+struct PackReader {
+    const char* base = nullptr;
+    size_t size = 0;
+    uint32_t frame_size = 0;
+    std::vector<PackIndexEntry> entries;
+
+    PackReader() = default;
+    PackReader(const PackReader&) = delete;
+    PackReader& operator=(const PackReader&) = delete;
+    ~PackReader() {
+        if (base) ::munmap(const_cast<char*>(base), size);
+    }
+
+    // Maps the archive and parses its index. Returns false if the file cannot
+    // be mapped, is not a BPK2 archive, or its index is corrupt.
+    bool open(const fs::path& path) {
+        int fd = io_open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < 20) {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<const char*>(p);
+        return parse_index();
+    }
+
+    const PackIndexEntry* find(const std::string& name) const {
+        for (const auto& e : entries) {
+            if (e.name == name) return &e;
+        }
+        return nullptr;
     }
-    return h;
+
+    // Decompresses entry e into out and checks it against the recorded
+    // checksum. Frames are independent, so they are decoded as OpenMP tasks.
+    bool extract(const PackIndexEntry& e, std::vector<char>& out) const {
+        out.assign(e.raw_size, 0);
+        bool ok = true;
+        #pragma omp taskloop grainsize(4) shared(e, out, ok)
+        for (size_t f = 0; f < e.frames.size(); ++f) {
+            const PackFrame& fr = e.frames[f];
+            size_t raw_off = f * frame_size;
+            size_t raw_len = std::min<size_t>(frame_size, e.raw_size - raw_off);
+            const char* src = base + fr.offset;
+            bool frame_ok = fr.codec == 1
+                ? lz_decompress(src, fr.stored_size, out.data() + raw_off, raw_len)
+                : fr.stored_size == raw_len;
+            if (frame_ok && fr.codec == 0) std::memcpy(out.data() + raw_off, src, raw_len);
+            if (!frame_ok) {
+                #pragma omp atomic write
+                ok = false;
+            }
+        }
+        return ok && checksum_bytes(out) == e.checksum;
+    }
+
+private:
+    bool parse_index() {
+        if (std::memcmp(base, kPackMagic, sizeof(kPackMagic)) != 0) return false;
+        uint32_t count;
+        uint64_t index_checksum;
+        std::memcpy(&count, base + 4, 4);
+        std::memcpy(&frame_size, base + 8, 4);
+        std::memcpy(&index_checksum, base + 12, 8);
+        if (frame_size == 0) return false;
+
+        size_t pos = 20;
+        auto take = [&](void* dst, size_t n) {
+            if (n > size - pos) return false;
+            std::memcpy(dst, base + pos, n);
+            pos += n;
+            return true;
+        };
+        // The index is only checked once it is read, so the counts must not be
+        // trusted to size anything: each entry takes at least 22 bytes (name
+        // length, raw size, checksum, frame count) and each frame 13.
+        if (count > (size - pos) / 22) return false;
+        entries.resize(count);
+        for (auto& e : entries) {
+            uint16_t name_len;
+            uint32_t frame_count;
+            if (!take(&name_len, 2) || name_len > size - pos) return false;
+            e.name.assign(base + pos, name_len);
+            pos += name_len;
+            if (!take(&e.raw_size, 8) || !take(&e.checksum, 8) || !take(&frame_count, 4)) return false;
+            if (frame_count != (e.raw_size + frame_size - 1) / frame_size) return false;
+            if (frame_count > (size - pos) / 13) return false;
+            e.frames.resize(frame_count);
+            for (auto& fr : e.frames) {
+                if (!take(&fr.offset, 8) || !take(&fr.stored_size, 4) || !take(&fr.codec, 1)) return false;
+                if (fr.offset > size || fr.stored_size > size - fr.offset || fr.codec > 1) return false;
+            }
+        }
+        return fnv1a_update(1469598103934665603ULL, base + 20, pos - 20) == index_checksum;
+    }
+};
+
+struct PackEntry {
+    std::string name;
+    std::vector<char> raw;
+    std::vector<std::vector<char>> frames;  // stored bytes of each frame
+    std::vector<uint8_t> codecs;
+    uint64_t checksum = 0;
+};
+
+// Packs pkg_dir into archive. Files are checksummed and compressed as OpenMP
+// tasks, so idle threads of the enclosing parallel loop help with large
+// packages. Returns false if any input is unreadable or the archive cannot be
+// written; adds the uncompressed and archive sizes to raw_bytes and packed_bytes.
+bool pack_package(const fs::path& pkg_dir, const fs::path& archive,
+                  uint64_t& raw_bytes, uint64_t& packed_bytes) {
+    std::vector<PackEntry> entries(1);
+    entries[0].name = "manifest.json";
+    std::vector<std::string> names;
+    fs::path files_dir = pkg_dir / "files";
+    if (fs::is_directory(files_dir)) {
+        for (auto& e : fs::directory_iterator(files_dir)) {
+            if (e.is_regular_file()) names.push_back(e.path().filename().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names) entries.push_back({"files/" + name, {}, {}, {}, 0});
+
+    // a. Read everything (I/O)
+    if (!read_file(pkg_dir / "manifest.json", entries[0].raw)) return false;
+    for (size_t i = 1; i < entries.size(); ++i) {
+        if (!read_file(files_dir / names[i - 1], entries[i].raw)) return false;
+    }
+
+    // b. Checksum and compress each frame (CPU); a frame is stored raw when
+    //    compression does not shrink it.
+    #pragma omp taskloop grainsize(1) shared(entries)
+    for (size_t i = 0; i < entries.size(); ++i) {
+        PackEntry& e = entries[i];
+        e.checksum = checksum_bytes(e.raw);
+        for (size_t off = 0; off < e.raw.size(); off += kPackFrameSize) {
+            size_t len = std::min<size_t>(kPackFrameSize, e.raw.size() - off);
+            std::vector<char> frame;
+            lz_compress(e.raw.data() + off, len, frame);
+            uint8_t codec = 1;
+            if (frame.size() >= len) {
+                frame.assign(e.raw.begin() + off, e.raw.begin() + off + len);
+                codec = 0;
+            }
+            e.frames.push_back(std::move(frame));
+            e.codecs.push_back(codec);
+        }
+    }
+
+    // c. Lay out the index, then write header, index and frames (I/O).
+    size_t index_size = 0;
+    for (const auto& e : entries) index_size += 2 + e.name.size() + 8 + 8 + 4 + e.frames.size() * (8 + 4 + 1);
+    uint64_t offset = 20 + index_size;
+    std::vector<char> index;
+    index.reserve(index_size);
+    for (const auto& e : entries) {
+        put_le<uint16_t>(index, static_cast<uint16_t>(e.name.size()));
+        index.insert(index.end(), e.name.begin(), e.name.end());
+        put_le<uint64_t>(index, e.raw.size());
+        put_le<uint64_t>(index, e.checksum);
+        put_le<uint32_t>(index, static_cast<uint32_t>(e.frames.size()));
+        for (size_t f = 0; f < e.frames.size(); ++f) {
+            put_le<uint64_t>(index, offset);
+            put_le<uint32_t>(index, static_cast<uint32_t>(e.frames[f].size()));
+            put_le<uint8_t>(index, e.codecs[f]);
+            offset += e.frames[f].size();
+        }
+    }
+    std::vector<char> header(kPackMagic, kPackMagic + sizeof(kPackMagic));
+    put_le<uint32_t>(header, static_cast<uint32_t>(entries.size()));
+    put_le<uint32_t>(header, kPackFrameSize);
+    put_le<uint64_t>(header, checksum_bytes(index));
+
+    fs::path tmp = archive.string() + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(header.data(), header.size());
+        out.write(index.data(), index.size());
+        for (const auto& e : entries) {
+            for (const auto& frame : e.frames) out.write(frame.data(), frame.size());
+        }
+        if (!out) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, archive, ec);
+    if (ec) return false;
+
+    for (const auto& e : entries) raw_bytes += e.raw.size();
+    packed_bytes += offset;
+    return true;
+}
+
+// Finds the first occurrence at or after pos of any relocation prefix and
+// returns its offset (n if none), with the matching rule in rule. Candidates
+// are found 16 positions at a time with SSE2 by comparing the first two bytes
+// of every prefix at once; only candidates are checked with memcmp.
+size_t find_prefix(const char* p, size_t n, size_t pos, size_t& rule) {
+    const auto& rules = install_settings().relocations;
+    auto match_at = [&](size_t i) {
+        for (size_t r = 0; r < rules.size(); ++r) {
+            const std::string& f = rules[r].from;
+            if (f.size() <= n - i && std::memcmp(p + i, f.data(), f.size()) == 0) {
+                rule = r;
+                return true;
+            }
+        }
+        return false;
+    };
+    size_t i = pos;
+#if defined(__SSE2__)
+    for (; i + 17 <= n; i += 16) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1));
+        int mask = 0;
+        for (const auto& r : rules) {
+            __m128i m0 = _mm_cmpeq_epi8(b0, _mm_set1_epi8(r.from[0]));
+            __m128i m1 = _mm_cmpeq_epi8(b1, _mm_set1_epi8(r.from[1]));
+            mask |= _mm_movemask_epi8(_mm_and_si128(m0, m1));
+        }
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (match_at(i + bit)) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (match_at(i)) return i;
+    }
+    return n;
+}
+
+// Rewrites the relocation prefixes in buf into out. Text files are rewritten
+// freely. Files containing a NUL byte are treated as binaries: each C string
+// holding a prefix is rewritten in place and NUL-padded to its old length, so
+// offsets do not move; an occurrence whose replacement is longer than the
+// prefix is left alone and counted in skipped. Returns false, leaving out
+// untouched, when buf contains no prefix.
+bool relocate_prefixes(const std::vector<char>& buf, std::vector<char>& out,
+                       uint64_t& replaced, uint64_t& skipped) {
+    const auto& rules = install_settings().relocations;
+    const char* p = buf.data();
+    const size_t n = buf.size();
+    size_t rule;
+    size_t pos = find_prefix(p, n, 0, rule);
+    if (pos == n) return false;
+
+    const bool binary = std::memchr(p, 0, n) != nullptr;
+    out.clear();
+    out.reserve(n);
+    size_t done = 0;
+    while (pos < n) {
+        if (!binary) {
+            out.insert(out.end(), p + done, p + pos);
+            out.insert(out.end(), rules[rule].to.begin(), rules[rule].to.end());
+            done = pos + rules[rule].from.size();
+            ++replaced;
+            pos = find_prefix(p, n, done, rule);
+            continue;
+        }
+        // Binary: rewrite the whole C string [pos, str_end) that holds the match.
+        const char* nul = static_cast<const char*>(std::memchr(p + pos, 0, n - pos));
+        size_t str_end = nul ? static_cast<size_t>(nul - p) : n;
+        std::string str;
+        uint64_t in_str = 0;
+        size_t at = pos, from = pos;
+        while (at < str_end) {
+            str.append(p + from, at - from);
+            str += rules[rule].to;
+            from = at + rules[rule].from.size();
+            ++in_str;
+            at = find_prefix(p, str_end, from, rule);
+        }
+        str.append(p + std::min(from, str_end), str_end - std::min(from, str_end));
+        out.insert(out.end(), p + done, p + pos);
+        if (str.size() <= str_end - pos) {
+            out.insert(out.end(), str.begin(), str.end());
+            out.insert(out.end(), str_end - pos - str.size(), '\0');
+            replaced += in_str;
+        } else {
+            out.insert(out.end(), p + pos, p + str_end);
+            skipped += in_str;
+        }
+        done = str_end;
+        pos = find_prefix(p, n, done, rule);
+    }
+    out.insert(out.end(), p + done, p + n);
+    return true;
+}
+
+// Writes a .meta record. When the installed bytes differ from the source
+// (after relocation), the source checksum is recorded as well.
+void put_meta(std::ostream& meta, uint64_t cs, uint64_t source_cs) {
+    meta << "checksum:" << cs << "\n";
+    if (source_cs != cs) meta << "source_checksum:" << source_cs << "\n";
+}
+
+// Writes a .meta file (see put_meta) through the engine's I/O entry points.
+bool write_meta_file(const fs::path& path, uint64_t cs, uint64_t source_cs) {
+    std::ostringstream meta;
+    put_meta(meta, cs, source_cs);
+    const std::string text = meta.str();
+    if (g_break_links) ::unlink(path.c_str());
+    int fd = io_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = io_pwrite(fd, text.data(), text.size(), 0, path) == static_cast<ssize_t>(text.size());
+    return io_close(fd, path) == 0 && ok;
+}
+
+// Reads the source checksum recorded in an installed file's .meta, that is the
+// checksum of the package file before any relocation. Returns false if the
+// file is missing or malformed, which upgrade mode treats as "changed".
+bool read_meta_checksum(const fs::path& meta_path, uint64_t& cs) {
+    std::ifstream meta(meta_path);
+    std::string line;
+    if (!std::getline(meta, line) || line.rfind("checksum:", 0) != 0) return false;
+    try {
+        cs = std::stoull(line.substr(9));
+        if (std::getline(meta, line) && line.rfind("source_checksum:", 0) == 0) {
+            cs = std::stoull(line.substr(16));
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Upgrade mode: deletes files (and their .meta) from an installed package that
+// the new version no longer ships. Returns the number of files removed.
+uint64_t remove_stale_files(const fs::path& out_pkg, const std::unordered_set<std::string>& keep) {
+    std::vector<fs::path> stale;
+    for (auto& e : fs::directory_iterator(out_pkg)) {
+        if (!e.is_regular_file() || e.path().extension() == ".meta") continue;
+        if (keep.count(e.path().filename().string()) == 0) stale.push_back(e.path());
+    }
+    std::error_code ec;
+    for (const auto& f : stale) {
+        fs::remove(f, ec);
+        fs::remove(fs::path(f.string() + ".meta"), ec);
+    }
+    return stale.size();
+}
+
+// Lazy mode: writes out_pkg/.lazy_index instead of copying the package. The
+// index names the source directory and lists every file with its size, so it
+// costs one directory scan and no file reads. Contents (and their .meta
+// checksums) are produced later by materialize_package.
+bool write_lazy_index(const fs::path& files_dir, const fs::path& out_pkg) {
+    if (g_break_links) ::unlink((out_pkg / ".lazy_index").c_str());
+    std::ofstream index(out_pkg / ".lazy_index", std::ios::trunc);
+    index << "source " << fs::absolute(files_dir).string() << "\n";
+    for (auto& e : fs::directory_iterator(files_dir)) {
+        if (!e.is_regular_file()) continue;
+        index << "file " << e.file_size() << " " << e.path().filename().string() << "\n";
+    }
+    return static_cast<bool>(index);
+}
+
+// Name a package is installed under: its directory name, or the archive name
+// without .bpk.
+std::string package_name(const fs::path& pkg_dir) {
+    return pkg_dir.extension() == ".bpk" ? pkg_dir.stem().string() : pkg_dir.filename().string();
 }
 
 // Processes a single package. This function is designed to be called in parallel.
-void process_package(const fs::path& pkg_dir, const fs::path& out_dir) {
+// Each source file is read and hashed once, then written to every output
+// directory in out_dirs; later targets are reflinked from the first when the
+// filesystem allows it. In upgrade mode, files whose checksum matches the
+// installed .meta are left alone, changed files are replaced through a temp
+// name and rename, and files the package no longer ships are deleted. In lazy
+// mode only a stub index is written; see write_lazy_index. A pkg_dir ending in
+// .bpk is read as a package archive written by --pack. The ledger record goes
+// to ledger under index, the package's position in the list; returns false
+// if the package failed before it had one, which includes any of its files
+// failing to read or write. result, if given, receives the
+// package's checksums, bytes and timings.
+bool process_package(const fs::path& pkg_dir, const std::vector<fs::path>& out_dirs, LedgerReorder& ledger,
+                     size_t index, PackageResult* result = nullptr) {
     int thread_id = omp_get_thread_num();
+    const InstallSettings& settings = install_settings();
+    const bool from_archive = pkg_dir.extension() == ".bpk";
+    const std::string pkg_name = package_name(pkg_dir);
     std::stringstream log_msg;
-    log_msg << "[Thread " << thread_id << "] ==> Starting package " << pkg_dir.filename().string();
+    log_msg << "[Thread " << thread_id << "] ==> Starting package " << pkg_name;
     sync_print(log_msg.str());
 
     auto start = Clock::now();
+    const uint64_t read_before = t_bytes_read, written_before = t_bytes_written;
 
-    // 1. Read manifest (I/O)
-    std::ifstream manifest(pkg_dir / "manifest.json", std::ios::binary);
-    if (!manifest) {
+    // 1. Read manifest (I/O) and list the package's files, from either a
+    //    package directory or a .bpk archive.
+    PackReader archive;
+    const PackIndexEntry* manifest_entry = nullptr;
+    std::vector<char> mcontents;
+    if (from_archive) {
+        if (archive.open(pkg_dir)) manifest_entry = archive.find("manifest.json");
+    }
+    if (from_archive ? !manifest_entry || !archive.extract(*manifest_entry, mcontents)
+                     : !read_file(pkg_dir / "manifest.json", mcontents)) {
         log_msg.str("");
-        log_msg << "[Thread " << thread_id << "] Error: Cannot open manifest for " << pkg_dir.filename().string();
+        log_msg << "[Thread " << thread_id << "] Error: Cannot open manifest for " << pkg_name;
         sync_print(log_msg.str());
-        return;
+        return false;
     }
-    std::string mcontents((std::istreambuf_iterator<char>(manifest)),
-                           std::istreambuf_iterator<char>());
 
     fs::path files_dir = pkg_dir / "files";
-    if (!fs::exists(files_dir) || !fs::is_directory(files_dir)) return;
+    std::vector<std::string> names;
+    std::vector<const PackIndexEntry*> archive_files;  // parallel to names
+    if (from_archive) {
+        for (const auto& e : archive.entries) {
+            if (e.name.rfind("files/", 0) != 0) continue;
+            names.push_back(e.name.substr(6));
+            archive_files.push_back(&e);
+        }
+    } else {
+        auto began = Clock::now();
+        bool have_files = fs::is_directory(files_dir);
+        trace_op(TraceOp::Stat, files_dir, 0, 0, began, have_files ? 0 : ENOENT);
+        if (!have_files) return false;
+        for (auto& p : fs::directory_iterator(files_dir)) {
+            if (p.is_regular_file()) names.push_back(p.path().filename().string());
+        }
+    }
 
-    fs::path out_pkg = out_dir / pkg_dir.filename();
-    fs::create_directories(out_pkg);
+    std::vector<fs::path> out_pkgs;
+    for (const auto& out_dir : out_dirs) {
+        out_pkgs.push_back(out_dir / pkg_name);
+        auto began = Clock::now();
+        fs::create_directories(out_pkgs.back());
+        trace_op(TraceOp::Mkdir, out_pkgs.back(), 0, 0, began, 0);
+    }
+
+    // Lazy mode indexes package directories; archives already allow random
+    // access, so they are always installed eagerly.
+    if (g_lazy && !from_archive) {
+        for (const auto& out_pkg : out_pkgs) {
+            if (!write_lazy_index(files_dir, out_pkg)) {
+                log_msg.str("");
+                log_msg << "[Thread " << thread_id << "] Error: Cannot write index for " << out_pkg.string();
+                sync_print(log_msg.str());
+                return false;
+            }
+        }
+        ledger.complete(index, pkg_name + " indexed\n");
+        if (result) {
+            result->name = pkg_name;
+            result->status = PackageResult::kInstalled;
+            result->seconds = seconds_since(start);
+        }
+        log_msg.str("");
+        log_msg << "[Thread " << thread_id << "] <== Indexed package " << pkg_name;
+        sync_print(log_msg.str());
+        return true;
+    }
 
     // 2. Process all files in the package
-    for (auto &p : fs::directory_iterator(files_dir)) {
-        if (!fs::is_regular_file(p.path())) continue;
-        
-        // a. Read file (I/O)
-        std::ifstream fin(p.path(), std::ios::binary);
-        std::vector<char> buf((std::istreambuf_iterator<char>(fin)),
-                              std::istreambuf_iterator<char>());
+    const size_t slot = static_cast<size_t>(thread_id);
+    const bool track_slow = slot < g_slow_files.size();
+    PhaseTimes pkg_phases;
+    std::unordered_set<std::string> shipped;
+    std::map<std::string, uint64_t> file_sums;  // sorted by name for the Merkle root
+    uint64_t changed = 0;
+    for (size_t f = 0; f < names.size(); ++f) {
+        const std::string& name = names[f];
+        if (settings.upgrade) shipped.insert(name);
 
-        // b. Compute checksum (CPU)
+        // a. Read file (I/O). Source holes are skipped, not read; archive
+        //    entries are decompressed frame by frame and checked.
+        auto file_start = Clock::now();
+        auto phase_start = file_start;
+        PhaseTimes fp;
+        double opens = t_open_seconds;
+        std::vector<char> buf;
+        bool read_ok;
+        if (from_archive) {
+            const PackIndexEntry* e = archive_files[f];
+            read_ok = archive.extract(*e, buf);
+            uint64_t stored = 0;
+            for (const auto& fr : e->frames) stored += fr.stored_size;
+            #pragma omp atomic
+            g_copy_stats.bytes_read += stored;
+            t_bytes_read += stored;
+        } else {
+            read_ok = read_file(files_dir / name, buf);
+        }
+        if (!read_ok) {
+            log_msg.str("");
+            log_msg << "[Thread " << thread_id << "] Error: Cannot read " << name << " from " << pkg_dir.string();
+            sync_print(log_msg.str());
+            return false;
+        }
+        record_file_phase(kPhaseRead, buf.size(), phase_start);
+        #pragma omp atomic
+        g_copy_stats.files_read++;
+        fp.open = t_open_seconds - opens;
+        fp.read = seconds_since(phase_start) - fp.open;
+
+        // b. Compute checksum (CPU). With --relocate, embedded prefixes are
+        //    rewritten into a second buffer; files without a match are
+        //    written from buf as they are.
+        phase_start = Clock::now();
         uint64_t cs = checksum_bytes(buf);
+        std::vector<char> relocated;
+        const std::vector<char>* data = &buf;
+        uint64_t installed_cs = cs;
+        if (!settings.relocations.empty()) {
+            uint64_t replaced = 0, skipped = 0;
+            if (relocate_prefixes(buf, relocated, replaced, skipped)) {
+                data = &relocated;
+                installed_cs = checksum_bytes(relocated);
+                #pragma omp atomic
+                g_copy_stats.files_relocated++;
+                #pragma omp atomic
+                g_copy_stats.relocations += replaced;
+                #pragma omp atomic
+                g_copy_stats.relocations_skipped += skipped;
+            }
+        }
+        file_sums[name] = installed_cs;
+        record_file_phase(kPhaseHash, buf.size(), phase_start);
+        fp.hash = seconds_since(phase_start);
+
+        // Modelled extra CPU work (decompression, patching, ...), if any.
+        if (g_workload.enabled()) {
+            uint64_t w = workload_apply(g_workload, buf);
+            #pragma omp atomic
+            g_workload_sink ^= w;
+        }
 
-        // c. Write file and metadata (I/O)
-        fs::path out_file = out_pkg / p.path().filename();
-        std::ofstream fout(out_file, std::ios::binary);
-        fout.write(buf.data(), buf.size());
-        std::ofstream meta(out_pkg / (p.path().filename().string() + ".meta"), std::ios::trunc);
-        meta << "checksum:" << cs << "\n";
+        // c. Write file and metadata to every target (I/O). Zero blocks become
+        //    holes; targets after the first try a reflink before writing.
+        //    In upgrade mode, unchanged files are skipped and the rest are
+        //    written under a temp name and renamed into place.
+        phase_start = Clock::now();
+        opens = t_open_seconds;
+        // Times one .meta write, minus its open (counted under open).
+        auto timed_meta = [&](const fs::path& p) {
+            auto m = Clock::now();
+            double o = t_open_seconds;
+            write_meta_file(p, installed_cs, cs);
+            fp.meta += seconds_since(m) - (t_open_seconds - o);
+        };
+        bool written = true;
+        for (size_t t = 0; t < out_pkgs.size(); ++t) {
+            fs::path out_file = out_pkgs[t] / name;
+            fs::path meta_file = out_pkgs[t] / (name + ".meta");
+            uint64_t old_cs;
+            if (settings.upgrade && read_meta_checksum(meta_file, old_cs) && old_cs == cs && fs::exists(out_file)) {
+                #pragma omp atomic
+                g_copy_stats.files_unchanged++;
+                continue;
+            }
+            fs::path dst = settings.upgrade ? out_pkgs[t] / ("." + name + ".tmp") : out_file;
+            bool ok = true;
+            const uint64_t written_before = t_bytes_written;
+            if (t > 0 && clone_file(out_pkgs[0] / name, dst)) {
+                #pragma omp atomic
+                g_copy_stats.bytes_cloned += data->size();
+            } else if (!write_file(dst, *data)) {
+                ok = written = false;
+                log_msg.str("");
+                log_msg << "[Thread " << thread_id << "] Error: Cannot write " << dst.string()
+                        << ": " << std::strerror(errno);
+                sync_print(log_msg.str());
+            }
+            if (t == 0) {
+                #pragma omp atomic
+                g_copy_stats.bytes_written_first += t_bytes_written - written_before;
+            }
+            if (settings.upgrade) {
+                std::error_code ec;
+                if (!ok) {
+                    fs::remove(dst, ec);
+                    continue;
+                }
+                fs::rename(dst, out_file, ec);
+                fs::path meta_tmp = out_pkgs[t] / ("." + name + ".meta.tmp");
+                timed_meta(meta_tmp);
+                fs::rename(meta_tmp, meta_file, ec);
+                ++changed;
+            } else {
+                if (g_break_links) ::unlink(meta_file.c_str());
+                timed_meta(meta_file);
+            }
+        }
+        if (!written) return false;
+        record_file_phase(kPhaseWrite, data->size(), phase_start);
+        fp.open += t_open_seconds - opens;
+        fp.write = seconds_since(phase_start) - (t_open_seconds - opens) - fp.meta;
+
+        pkg_phases.add(fp);
+        double file_seconds = seconds_since(file_start);
+        if (track_slow && g_slow_files[slot].wants(file_seconds)) {
+            g_slow_files[slot].offer({file_seconds, pkg_name + "/" + name, fp, thread_id, ::sched_getcpu()});
+        }
     }
 
-    // 3. Update a central DB file. This must be serialized to prevent race conditions.
-    // An OpenMP critical section ensures that only one thread can execute this block at a time.
-    #pragma omp critical
-    {
-        fs::path dbfile = out_dir / "install_db.txt";
-        std::ofstream db(dbfile, std::ios::app);
-        db << pkg_dir.filename().string() << " installed by thread " << thread_id << "\n";
+    // In upgrade mode, drop files the new version no longer ships.
+    uint64_t removed = 0;
+    if (settings.upgrade) {
+        for (const auto& out_pkg : out_pkgs) removed += remove_stale_files(out_pkg, shipped);
+        #pragma omp atomic
+        g_copy_stats.files_removed += removed;
+    }
+
+    // The package's Merkle root over its file checksums, sorted by path.
+    std::vector<uint64_t> leaves;
+    for (const auto& [fname, fcs] : file_sums) leaves.push_back(merkle_leaf(fname, fcs));
+    const std::string root = hex64(merkle_levels(std::move(leaves)).back()[0]);
+
+    // 3. Hand the ledger record to the reorder buffer, which appends it to
+    //    every target's install_db.txt once all earlier packages are done.
+    //    The record leaves out the thread so that ledgers can be diffed.
+    std::ostringstream record;
+    if (settings.upgrade) {
+        record << pkg_name << " upgraded (" << changed / out_dirs.size() << " changed, "
+               << removed / out_dirs.size() << " removed) merkle=" << root << "\n";
+    } else {
+        record << pkg_name << " installed merkle=" << root << "\n";
     }
+    pkg_phases.ledger_wait = ledger.complete(index, record.str());
 
     auto end = Clock::now();
     std::chrono::duration<double> dur = end - start;
+    if (result) {
+        result->name = pkg_name;
+        result->status = PackageResult::kInstalled;
+        result->merkle = root;
+        result->files = file_sums.size();
+        result->bytes_read = t_bytes_read - read_before;
+        result->bytes_written = t_bytes_written - written_before;
+        result->seconds = dur.count();
+        result->phases = pkg_phases;
+        result->checksums = std::move(file_sums);
+    }
+    if (track_slow && g_slow_packages[slot].wants(dur.count())) {
+        g_slow_packages[slot].offer({dur.count(), pkg_name, pkg_phases, thread_id, ::sched_getcpu()});
+    }
     
     log_msg.str(""); // Clear the stringstream
-    log_msg << "[Thread " << thread_id << "] <== Finished package " << pkg_dir.filename().string()
+    log_msg << "[Thread " << thread_id << "] <== Finished package " << pkg_name
             << " in " << std::fixed << std::setprecision(4) << dur.count() << "s.";
     sync_print(log_msg.str());
+    return true;
 }
 
+// Deletes everything inside the directory open at dir_fd. Entry types come
+// from the d_type that getdents fills in, so no entry is stat'd unless the
+// filesystem reports DT_UNKNOWN. Takes ownership of dir_fd. Returns the number
+// of files removed, or -1 on the first failure.
+long remove_dir_contents(int dir_fd) {
+    DIR* d = ::fdopendir(dir_fd);
+    if (!d) {
+        ::close(dir_fd);
+        return -1;
+    }
+    long removed = 0;
+    while (struct dirent* e = ::readdir(d)) {
+        const char* name = e->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+        bool is_dir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            int sub = ::openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            long n = sub < 0 ? -1 : remove_dir_contents(sub);
+            if (n < 0 || ::unlinkat(dir_fd, name, AT_REMOVEDIR) != 0) {
+                removed = -1;
+                break;
+            }
+            removed += n;
+        } else if (::unlinkat(dir_fd, name, 0) == 0) {
+            ++removed;
+        } else {
+            removed = -1;
+            break;
+        }
+    }
+    ::closedir(d);
+    return removed;
+}
+
+// Removes the directory tree at path with unlinkat. Returns the number of
+// files removed, or -1 on failure. A missing path counts as zero files.
+long remove_tree(const fs::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    long n = remove_dir_contents(fd);
+    if (n < 0 || ::rmdir(path.c_str()) != 0) return -1;
+    return n;
+}
+
+// Returns the package names recorded in out_dir/install_db.txt, in ledger
+// order and without duplicates (an upgraded package appears more than once).
+std::vector<std::string> read_ledger_packages(const fs::path& out_dir) {
+    std::vector<std::string> names;
+    std::unordered_set<std::string> seen;
+    std::ifstream db(out_dir / "install_db.txt");
+    std::string line;
+    while (std::getline(db, line)) {
+        std::string name = line.substr(0, line.find(' '));
+        if (!name.empty() && seen.insert(name).second) names.push_back(name);
+    }
+    return names;
+}
+
+// Rewrites out_dir/install_db.txt without the lines for the given packages.
+// The new ledger is written to a temp file and renamed over the old one.
+void drop_from_ledger(const fs::path& out_dir, const std::unordered_set<std::string>& drop) {
+    fs::path dbfile = out_dir / "install_db.txt";
+    fs::path tmpfile = out_dir / ".install_db.txt.tmp";
+    {
+        std::ifstream db(dbfile);
+        std::ofstream out(tmpfile, std::ios::trunc);
+        std::string line;
+        while (std::getline(db, line)) {
+            if (drop.count(line.substr(0, line.find(' '))) == 0) out << line << "\n";
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmpfile, dbfile, ec);
+}
+
+// Compares two installs. Equal roots settle it with one line read from each
+// side. Otherwise both package lists are read in full and compared by name,
+// listing packages whose roots differ or that are present on one side only.
+int run_compare(const fs::path& a, const fs::path& b) {
+    uint64_t ra, rb;
+    std::vector<std::pair<std::string, uint64_t>> pa, pb;
+    if (!read_install_merkle(a, ra, nullptr) || !read_install_merkle(b, rb, nullptr)) {
+        std::cerr << "Error: Missing or malformed install_merkle.txt\n";
+        return 2;
+    }
+    if (ra == rb) {
+        std::cout << "Installs are identical (root " << hex64(ra) << ").\n";
+        return 0;
+    }
+    if (!read_install_merkle(a, ra, &pa) || !read_install_merkle(b, rb, &pb)) {
+        std::cerr << "Error: Malformed install_merkle.txt\n";
+        return 2;
+    }
+
+    std::vector<std::string> differ;
+    std::map<std::string, uint64_t> mb(pb.begin(), pb.end());
+    for (const auto& [name, root] : pa) {
+        auto it = mb.find(name);
+        if (it == mb.end() || it->second != root) differ.push_back(name);
+        if (it != mb.end()) mb.erase(it);
+    }
+    for (const auto& [name, root] : mb) differ.push_back(name);
+
+    std::cout << "Installs differ (" << hex64(ra) << " vs " << hex64(rb) << "), "
+              << differ.size() << " packages:\n";
+    for (const auto& name : differ) std::cout << "  " << name << "\n";
+    return 1;
+}
+
+// Uninstall (or prune) mode. Deletes out_dir/<name> for each name in parallel
+// and then drops them from the ledger in one rewrite. With use_trash, the
+// package directories are first renamed into out_dir/.trash, the ledger is
+// updated, and the actual deletion runs in a background child process; the
+// command returns once the renames have happened.
+int run_remove(const std::vector<std::string>& names, const fs::path& out_dir, bool use_trash) {
+    auto t0 = Clock::now();
+    std::vector<fs::path> victims(names.size());
+    std::vector<char> ok(names.size(), 0);
+    long files_removed = 0;
+
+    fs::path trash = out_dir / ".trash";
+    if (use_trash) fs::create_directories(trash);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < names.size(); ++i) {
+        fs::path pkg = out_dir / names[i];
+        if (use_trash) {
+            // Unique per run and package so an older trash entry never collides.
+            victims[i] = trash / (names[i] + "." + std::to_string(::getpid()) + "." + std::to_string(i));
+            std::error_code ec;
+            fs::rename(pkg, victims[i], ec);
+            ok[i] = !ec || ec == std::errc::no_such_file_or_directory;
+            continue;
+        }
+        long n = remove_tree(pkg);
+        ok[i] = n >= 0;
+        if (n > 0) {
+            #pragma omp atomic
+            files_removed += n;
+        }
+        if (n < 0) sync_print("Error: Cannot remove " + pkg.string() + ": " + std::strerror(errno));
+    }
+
+    std::unordered_set<std::string> gone;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (ok[i]) gone.insert(names[i]);
+    }
+    drop_from_ledger(out_dir, gone);
+    write_install_merkle(out_dir);
+
+    std::chrono::duration<double> ready = Clock::now() - t0;
+    std::cout << "Removed " << gone.size() << "/" << names.size() << " packages from "
+              << out_dir.string() << " in " << std::fixed << std::setprecision(4)
+              << ready.count() << " seconds";
+    if (!use_trash) {
+        std::cout << " (" << files_removed << " files).\n";
+        return gone.size() == names.size() ? 0 : 1;
+    }
+    std::cout << " (moved to trash).\n";
+
+    // Empty the whole trash area, including leftovers from earlier runs, in a
+    // child process so the command returns as soon as the renames are done.
+    std::cout.flush();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        std::error_code ec;
+        for (auto& e : fs::directory_iterator(trash, ec)) remove_tree(e.path());
+        ::_exit(0);
+    }
+    if (pid < 0) {
+        for (auto& e : fs::directory_iterator(trash)) remove_tree(e.path());
+    }
+    return gone.size() == names.size() ? 0 : 1;
+}
+
+// The snapshot of an output directory lives next to it, so that rollback can
+// swap the two with a single rename on the same filesystem.
+fs::path snapshot_path(const fs::path& out_dir) {
+    fs::path dir = out_dir;
+    if (!dir.has_filename()) dir = dir.parent_path();
+    return dir.string() + ".snapshot";
+}
+
+// Unchanged files stay hardlinked to a snapshot across later runs, so any run
+// that writes into out_dir must break links while the snapshot exists.
+void break_links_if_snapshot(const fs::path& out_dir) {
+    std::error_code ec;
+    if (fs::exists(snapshot_path(out_dir), ec)) g_break_links = true;
+}
+
+// Recreates the tree under src at dst without copying file data: each file is
+// reflinked when the filesystem supports it and hardlinked otherwise. The
+// ledger is copied, because it is appended to in place. Returns the number
+// of files linked, or -1 on failure.
+long snapshot_tree(const fs::path& src, const fs::path& dst) {
+    std::error_code ec;
+    fs::create_directory(dst, ec);
+    if (ec) return -1;
+    long n = 0;
+    for (auto& e : fs::directory_iterator(src)) {
+        fs::path to = dst / e.path().filename();
+        if (e.is_directory()) {
+            long sub = snapshot_tree(e.path(), to);
+            if (sub < 0) return -1;
+            n += sub;
+        } else if (e.path().filename() == "install_db.txt") {
+            fs::copy_file(e.path(), to, ec);
+            if (ec) return -1;
+        } else if (e.is_regular_file()) {
+            if (!clone_file(e.path(), to)) {
+                fs::create_hard_link(e.path(), to, ec);
+                if (ec) return -1;
+            }
+            ++n;
+        }
+    }
+    return n;
+}
+
+// Takes a snapshot of out_dir before an install, replacing any previous one.
+// Packages are linked in parallel; the snapshot is built under a temp name and
+// renamed into place, so a half-built snapshot is never used for rollback.
+bool take_snapshot(const fs::path& out_dir) {
+    auto t0 = Clock::now();
+    fs::path snap = snapshot_path(out_dir);
+    fs::path tmp = snap.string() + ".tmp";
+    remove_tree(tmp);
+    std::error_code ec;
+    fs::create_directory(tmp, ec);
+    if (ec) return false;
+
+    std::vector<fs::directory_entry> entries;
+    for (auto& e : fs::directory_iterator(out_dir)) {
+        if (e.path().filename() != ".trash") entries.push_back(e);
+    }
+    long files = 0;
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:files) reduction(&&:ok)
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const fs::path& from = entries[i].path();
+        fs::path to = tmp / from.filename();
+        long n = 0;
+        std::error_code lec;
+        if (entries[i].is_directory()) {
+            n = snapshot_tree(from, to);
+        } else if (from.filename() == "install_db.txt") {
+            fs::copy_file(from, to, lec);
+        } else if (!clone_file(from, to)) {
+            fs::create_hard_link(from, to, lec);
+            n = 1;
+        }
+        if (n < 0 || lec) ok = false;
+        else files += n;
+    }
+    if (!ok) {
+        remove_tree(tmp);
+        return false;
+    }
+    remove_tree(snap);
+    fs::rename(tmp, snap, ec);
+    if (ec) return false;
+    g_break_links = true;
+
+    std::chrono::duration<double> dur = Clock::now() - t0;
+    std::cout << "Snapshot of " << out_dir.string() << " (" << files << " files) taken in "
+              << std::fixed << std::setprecision(4) << dur.count() << " seconds.\n";
+    return true;
+}
+
+// Swaps the snapshot back in place of out_dir. renameat2(RENAME_EXCHANGE)
+// makes the swap atomic; on filesystems without it, two renames are used.
+// The replaced install is then deleted.
+int run_rollback(const fs::path& out_dir) {
+    auto t0 = Clock::now();
+    fs::path snap = snapshot_path(out_dir);
+    if (!fs::is_directory(snap)) {
+        std::cerr << "Error: No snapshot found for " << out_dir.string() << "\n";
+        return 1;
+    }
+    if (::renameat2(AT_FDCWD, snap.c_str(), AT_FDCWD, out_dir.c_str(), RENAME_EXCHANGE) != 0) {
+        fs::path old = snap.string() + ".old";
+        std::error_code ec;
+        fs::rename(out_dir, old, ec);
+        if (ec) {
+            std::cerr << "Error: Cannot move " << out_dir.string() << " aside: " << ec.message() << "\n";
+            return 1;
+        }
+        fs::rename(snap, out_dir, ec);
+        if (ec) {
+            std::cerr << "Error: Cannot restore snapshot: " << ec.message() << "\n";
+            fs::rename(old, out_dir, ec);
+            return 1;
+        }
+        snap = old;
+    }
+    std::chrono::duration<double> swapped = Clock::now() - t0;
+    remove_tree(snap);
+    std::cout << "Rolled back " << out_dir.string() << " in " << std::fixed << std::setprecision(4)
+              << swapped.count() << " seconds.\n";
+    return 0;
+}
+
+// Copies the files listed in out_pkg/.lazy_index from their source, writes
+// their .meta checksums and removes the index. A source file whose size no
+// longer matches the index is reported, and the package stays lazy. Returns
+// the package's Merkle root through root.
+bool materialize_package(const fs::path& out_pkg, uint64_t& root) {
+    std::ifstream index(out_pkg / ".lazy_index");
+    std::string key, source;
+    if (!(index >> key) || key != "source" || !std::getline(index >> std::ws, source)) return false;
+
+    std::map<std::string, uint64_t> file_sums;
+    uint64_t size;
+    std::string name;
+    while (index >> key >> size && std::getline(index >> std::ws, name)) {
+        std::vector<char> buf;
+        if (!read_file(fs::path(source) / name, buf) || buf.size() != size) {
+            sync_print("Error: Source changed or missing: " + (fs::path(source) / name).string());
+            return false;
+        }
+        uint64_t cs = checksum_bytes(buf);
+        file_sums[name] = cs;
+        if (!write_file(out_pkg / name, buf)) {
+            sync_print("Error: Cannot write " + (out_pkg / name).string() + ": " + std::strerror(errno));
+            return false;
+        }
+        write_meta_file(out_pkg / (name + ".meta"), cs, cs);
+    }
+    index.close();
+
+    std::vector<uint64_t> leaves;
+    for (const auto& [fname, fcs] : file_sums) leaves.push_back(merkle_leaf(fname, fcs));
+    root = merkle_levels(std::move(leaves)).back()[0];
+    std::error_code ec;
+    fs::remove(out_pkg / ".lazy_index", ec);
+    return true;
+}
+
+// Materializes lazily installed packages of out_dir in parallel: the named
+// ones, or every package that still has a .lazy_index when names is empty.
+// Each finished package gets a ledger line with its Merkle root.
+int run_materialize(const fs::path& out_dir, std::vector<std::string> names) {
+    auto t0 = Clock::now();
+    if (names.empty()) {
+        for (const auto& name : read_ledger_packages(out_dir)) {
+            if (fs::exists(out_dir / name / ".lazy_index")) names.push_back(name);
+        }
+    }
+    LedgerReorder ledger;
+    ledger.reset(names.size(), 1024, [&](const std::string& records) {
+        std::ofstream db(out_dir / "install_db.txt", std::ios::app);
+        db << records;
+    });
+    int failed = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:failed)
+    for (size_t i = 0; i < names.size(); ++i) {
+        ledger.start(i);
+        uint64_t root;
+        if (!materialize_package(out_dir / names[i], root)) {
+            ++failed;
+            ledger.complete(i, {});
+            continue;
+        }
+        ledger.complete(i, names[i] + " materialized merkle=" + hex64(root) + "\n");
+    }
+    write_install_merkle(out_dir);
+
+    std::chrono::duration<double> dur = Clock::now() - t0;
+    std::cout << "Materialized " << names.size() - failed << "/" << names.size() << " packages in "
+              << out_dir.string() << " in " << std::fixed << std::setprecision(4) << dur.count()
+              << " seconds.\n";
+    return failed ? 1 : 0;
+}
+
+// Pack mode: writes <archive_dir>/<package>.bpk for every listed package,
+// packing packages in parallel, and reports throughput per thread.
+int run_pack(const std::vector<fs::path>& pkg_dirs, const fs::path& archive_dir) {
+    fs::create_directories(archive_dir);
+    auto t0 = Clock::now();
+    uint64_t raw_bytes = 0, packed_bytes = 0;
+    int failed = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:raw_bytes, packed_bytes, failed)
+    for (size_t i = 0; i < pkg_dirs.size(); ++i) {
+        fs::path archive = archive_dir / (pkg_dirs[i].filename().string() + ".bpk");
+        if (!pack_package(pkg_dirs[i], archive, raw_bytes, packed_bytes)) {
+            sync_print("Error: Cannot pack " + pkg_dirs[i].string());
+            ++failed;
+        }
+    }
+
+    std::chrono::duration<double> dur = Clock::now() - t0;
+    double mb = raw_bytes / 1e6;
+    int threads = omp_get_max_threads();
+    std::cout << "Packed " << pkg_dirs.size() - failed << "/" << pkg_dirs.size() << " packages ("
+              << raw_bytes << " -> " << packed_bytes << " bytes) in " << std::fixed
+              << std::setprecision(4) << dur.count() << " seconds, "
+              << std::setprecision(1) << mb / dur.count() << " MB/s, "
+              << mb / dur.count() / threads << " MB/s per core (threads=" << threads << ").\n";
+    return failed ? 1 : 0;
+}
+
+// Extract mode: writes the named files of a .bpk archive (all entries when none
+// are named) under out_dir, decoding entries in parallel. Every extracted file
+// is checked against its recorded checksum.
+int run_extract(const fs::path& archive_path, const fs::path& out_dir, const std::vector<std::string>& names) {
+    PackReader archive;
+    if (!archive.open(archive_path)) {
+        std::cerr << "Error: Cannot read archive " << archive_path.string() << "\n";
+        return 1;
+    }
+    std::vector<const PackIndexEntry*> wanted;
+    for (const auto& e : archive.entries) {
+        if (names.empty() || std::find(names.begin(), names.end(), e.name) != names.end()) wanted.push_back(&e);
+    }
+    if (!names.empty() && wanted.size() != names.size()) {
+        std::cerr << "Error: Some requested files are not in " << archive_path.string() << "\n";
+        return 1;
+    }
+    int failed = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:failed)
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        std::vector<char> buf;
+        fs::path out_file = out_dir / wanted[i]->name;
+        fs::create_directories(out_file.parent_path());
+        if (!archive.extract(*wanted[i], buf) || !write_file(out_file, buf)) {
+            sync_print("Error: Cannot extract " + wanted[i]->name);
+            ++failed;
+        }
+    }
+    std::cout << "Extracted " << wanted.size() - failed << "/" << wanted.size() << " files from "
+              << archive_path.string() << ".\n";
+    return failed ? 1 : 0;
+}
+
+// Verify mode: checks the named files of a .bpk archive (all entries when none
+// are named) against their checksums. Only the frames of those files are read.
+int run_verify_archive(const fs::path& archive_path, const std::vector<std::string>& names) {
+    PackReader archive;
+    if (!archive.open(archive_path)) {
+        std::cerr << "Error: Archive " << archive_path.string() << " is unreadable or its index is corrupt\n";
+        return 1;
+    }
+    std::vector<const PackIndexEntry*> wanted;
+    for (const auto& e : archive.entries) {
+        if (names.empty() || std::find(names.begin(), names.end(), e.name) != names.end()) wanted.push_back(&e);
+    }
+    int bad = static_cast<int>(names.empty() ? 0 : names.size() - wanted.size());
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:bad)
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        std::vector<char> buf;
+        if (!archive.extract(*wanted[i], buf)) {
+            sync_print("Checksum mismatch: " + wanted[i]->name);
+            ++bad;
+        }
+    }
+    std::cout << "Verified " << wanted.size() << " files in " << archive_path.string() << ": "
+              << (bad ? std::to_string(bad) + " bad.\n" : std::string("all good.\n"));
+    return bad ? 1 : 0;
+}
+
+// Hardware limits measured by --calibrate, kept in <output_dir>/calibration.txt
+// as "<key> <value>" lines. An install into that directory reports its
+// throughput as a percentage of them (see print_roofline).
+using Calibration = std::map<std::string, double>;
+
+Calibration read_calibration(const fs::path& out_dir) {
+    Calibration c;
+    std::ifstream in(out_dir / "calibration.txt");
+    std::string key;
+    double v;
+    while (in >> key >> v) c[key] = v;
+    return c;
+}
+
+// Best-of-5 STREAM copy and triad over arrays well beyond the last-level
+// cache, on all threads. Returns bytes per second moved by each kernel.
+void calibrate_stream(double& copy_bps, double& triad_bps) {
+    const size_t n = size_t(1) << 23;  // 64 MiB per array
+    std::vector<double> a(n), b(n), c(n);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+    double best_copy = 1e30, best_triad = 1e30;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto t0 = Clock::now();
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i) c[i] = a[i];
+        auto t1 = Clock::now();
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i) a[i] = b[i] + 3.0 * c[i];
+        auto t2 = Clock::now();
+        best_copy = std::min(best_copy, std::chrono::duration<double>(t1 - t0).count());
+        best_triad = std::min(best_triad, std::chrono::duration<double>(t2 - t1).count());
+    }
+    copy_bps = 2 * sizeof(double) * n / best_copy;
+    triad_bps = 3 * sizeof(double) * n / best_triad;
+}
+
+// Single-core checksum_bytes throughput over a cache-resident buffer, in bytes
+// per second and per TSC cycle (the TSC ticks at the nominal frequency, so
+// turbo shows up as more than the nominal bytes/cycle).
+void calibrate_checksum(double& bps, double& bytes_per_cycle) {
+    std::vector<char> buf(256 << 10);
+    for (size_t i = 0; i < buf.size(); ++i) buf[i] = static_cast<char>(i * 131);
+    volatile uint64_t sink = 0;
+    size_t passes = 0;
+    auto t0 = Clock::now();
+#if defined(__x86_64__)
+    uint64_t c0 = __rdtsc();
+#endif
+    while (std::chrono::duration<double>(Clock::now() - t0).count() < 0.3) {
+        sink = sink + checksum_bytes(buf);
+        ++passes;
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    bps = passes * buf.size() / secs;
+    bytes_per_cycle = 0;
+#if defined(__x86_64__)
+    bytes_per_cycle = passes * buf.size() / static_cast<double>(__rdtsc() - c0);
+#endif
+}
+
+// Storage bandwidth and IOPS of the filesystem holding dir, through a scratch
+// file. O_DIRECT keeps the page cache out of the numbers; filesystems without
+// it (tmpfs) are measured buffered, with the read cache dropped by fadvise.
+// Some filesystems accept O_DIRECT at open and refuse the I/O with EINVAL;
+// the file is then reopened buffered. Rates are over the bytes actually
+// transferred. If nothing could be written, no storage figures are recorded.
+void calibrate_storage(const fs::path& dir, Calibration& c) {
+    const size_t file_bytes = 256 << 20, block = 1 << 20, small = 4096;
+    fs::path scratch = dir / ".calibrate.tmp";
+    bool direct = true;
+    int fd = ::open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        direct = false;
+        fd = ::open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (fd < 0) return;
+    void* mem = nullptr;
+    if (::posix_memalign(&mem, 4096, block) != 0) {
+        ::close(fd);
+        return;
+    }
+    std::unique_ptr<char, decltype(&std::free)> buf(static_cast<char*>(mem), &std::free);
+    std::memset(buf.get(), 0x5A, block);  // not zero, so nothing is skipped as sparse
+
+    auto secs = [](Clock::time_point t) { return std::chrono::duration<double>(Clock::now() - t).count(); };
+    auto t = Clock::now();
+    size_t written = 0;
+    while (written < file_bytes) {
+        ssize_t n = ::pwrite(fd, buf.get(), block, written);
+        if (n < 0 && errno == EINVAL && direct && written == 0) {
+            ::close(fd);
+            direct = false;
+            fd = ::open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                ::unlink(scratch.c_str());
+                return;
+            }
+            t = Clock::now();
+            continue;
+        }
+        if (n <= 0) break;
+        written += static_cast<size_t>(n);
+    }
+    ::fsync(fd);
+    double write_secs = secs(t);
+    if (written < small) {
+        std::cerr << "Error: Cannot write " << scratch.string() << "; storage not calibrated\n";
+        ::close(fd);
+        ::unlink(scratch.c_str());
+        return;
+    }
+    c["storage_direct"] = direct;
+    c["seq_write_bps"] = written / write_secs;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    size_t got = 0;
+    t = Clock::now();
+    while (got < written) {
+        ssize_t n = ::pread(fd, buf.get(), std::min(block, written - got), got);
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+    }
+    c["seq_read_bps"] = got / secs(t);
+
+    // Random 4 KiB I/O from every thread for a fixed time, so the queue
+    // depth matches the install loop's.
+    for (int write = 0; write < 2; ++write) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        uint64_t ops = 0;
+        t = Clock::now();
+        #pragma omp parallel reduction(+:ops)
+        {
+            void* p = nullptr;
+            if (::posix_memalign(&p, 4096, small) == 0) {
+                std::memset(p, 0x5A, small);
+                uint64_t x = io_shim_mix(omp_get_thread_num() + 1);
+                while (std::chrono::duration<double>(Clock::now() - t).count() < 1.0) {
+                    x = io_shim_mix(x);
+                    off_t off = static_cast<off_t>(x % (written / small)) * small;
+                    ssize_t r = write ? ::pwrite(fd, p, small, off) : ::pread(fd, p, small, off);
+                    if (r != static_cast<ssize_t>(small)) break;
+                    ++ops;
+                }
+                std::free(p);
+            }
+        }
+        if (write) ::fsync(fd);
+        c[write ? "rand_write_iops" : "rand_read_iops"] = ops / secs(t);
+    }
+    ::close(fd);
+    ::unlink(scratch.c_str());
+}
+
+// Calibrate mode: measures the machine's limits and records them for installs
+// into out_dir.
+int run_calibrate(const fs::path& out_dir) {
+    fs::create_directories(out_dir);
+    Calibration c;
+    std::cout << "Calibrating with " << omp_get_max_threads() << " threads on " << out_dir.string() << "...\n";
+    calibrate_stream(c["stream_copy_bps"], c["stream_triad_bps"]);
+    calibrate_checksum(c["checksum_bps"], c["checksum_bytes_per_cycle"]);
+    calibrate_storage(out_dir, c);
+    c["threads"] = omp_get_max_threads();
+
+    fs::path tmp = out_dir / ".calibration.txt.tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << std::setprecision(6);
+        for (const auto& [key, v] : c) out << key << " " << v << "\n";
+    }
+    std::error_code ec;
+    fs::rename(tmp, out_dir / "calibration.txt", ec);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Memory (STREAM):  copy " << c["stream_copy_bps"] / 1e9 << " GB/s, triad "
+              << c["stream_triad_bps"] / 1e9 << " GB/s\n"
+              << "Checksum (1 core): " << c["checksum_bps"] / 1e9 << " GB/s, " << std::setprecision(2)
+              << c["checksum_bytes_per_cycle"] << " bytes/cycle\n" << std::setprecision(1);
+    if (c.count("seq_write_bps")) {
+        std::cout << "Storage" << (c["storage_direct"] ? " (O_DIRECT)" : " (buffered)") << ": seq read "
+                  << c["seq_read_bps"] / 1e6 << " MB/s, seq write " << c["seq_write_bps"] / 1e6
+                  << " MB/s, 4K random read " << std::setprecision(0) << c["rand_read_iops"] << " IOPS, write "
+                  << c["rand_write_iops"] << " IOPS\n";
+    } else {
+        std::cout << "Storage: not measured\n";
+    }
+    std::cout << "Wrote " << (out_dir / "calibration.txt").string() << ".\n";
+    return ec ? 1 : 0;
+}
+
+// Prints an install's throughput against the calibrated limits of its first
+// output directory. Reads and writes are compared with sequential bandwidth
+// and files per second with random IOPS (each file costs at least one small
+// read or write); hashing with the single-core checksum rate times the cores
+// in use; and the bytes the loop moves through memory (read into a buffer,
+// hashed, written out) with STREAM copy bandwidth.
+void print_roofline(const Calibration& c, double seconds, uint64_t files) {
+    auto get = [&](const char* k) {
+        auto it = c.find(k);
+        return it == c.end() ? 0.0 : it->second;
+    };
+    auto pct = [](double achieved, double limit) { return limit > 0 ? 100.0 * achieved / limit : 0.0; };
+    double rd = g_copy_stats.bytes_read / seconds, wr = g_copy_stats.bytes_written / seconds;
+    double fps = files / seconds;
+    int cores = std::min(omp_get_max_threads(), omp_get_num_procs());
+    std::cout << std::fixed << std::setprecision(1) << "Roofline: read " << rd / 1e6 << " MB/s ("
+              << pct(rd, get("seq_read_bps")) << "% of seq read), write " << wr / 1e6 << " MB/s ("
+              << pct(wr, get("seq_write_bps")) << "% of seq write), " << std::setprecision(0) << fps
+              << " files/s (" << std::setprecision(1) << pct(fps, get("rand_read_iops")) << "% of 4K read IOPS, "
+              << pct(fps, get("rand_write_iops")) << "% of 4K write IOPS),\n          hash "
+              << pct(rd, cores * get("checksum_bps")) << "% of " << cores << "-core checksum rate, memory "
+              << pct(3 * rd, get("stream_copy_bps")) << "% of STREAM copy.\n";
+}
+
+// Energy summary (--energy): the run's joules per GB written and per package,
+// CPU seconds per package, then one line per phase.
+void print_energy(const EnergyMeter& meter, int packages, uint64_t bytes_written) {
+    EnergyPhase t = meter.total();
+    double joules = t.package_j + t.dram_j;
+    double gb = bytes_written / 1e9;
+    std::cout << std::fixed << std::setprecision(3);
+    if (meter.has_rapl()) {
+        std::cout << "Energy (" << meter.domains().size() << " RAPL domains): " << t.package_j << " J package + "
+                  << t.dram_j << " J DRAM; " << (gb > 0 ? joules / gb : 0.0) << " J/GB, "
+                  << (packages ? joules / packages : 0.0) << " J/package, " << std::setprecision(1)
+                  << (joules > 0 ? packages / joules : 0.0) << " packages/J.\n";
+    } else {
+        std::cout << "Energy: no readable RAPL counters under /sys/class/powercap (energy_uj may need root).\n";
+    }
+    std::cout << std::setprecision(4) << "CPU time " << t.cpu_seconds << " s, "
+              << (packages ? 1e3 * t.cpu_seconds / packages : 0.0) << " ms/package.\n";
+    for (const auto& p : meter.phases()) {
+        std::cout << "  " << std::left << std::setw(9) << p.name << std::right << std::setw(9) << p.seconds
+                  << " s wall" << std::setw(9) << p.cpu_seconds << " s CPU";
+        if (meter.has_rapl()) std::cout << std::setw(10) << std::setprecision(3) << p.package_j << " J package"
+                                        << std::setw(9) << p.dram_j << " J DRAM" << std::setprecision(4);
+        std::cout << "\n";
+    }
+}
+
+// Escapes s for a JSON string literal.
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char ch : s) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += ch;
+        }
+    }
+    return out;
+}
+
+// Benchmark report (--report-json) read by bench_compare. The config object
+// identifies what was measured, so reports of different builds can be
+// aligned; package_seconds holds every package's wall time in list order.
+bool write_json_report(const fs::path& path, const std::string& label, const std::string& executor,
+                       const std::string& backend, const fs::path& dataset, size_t outputs, double seconds,
+                       const std::vector<double>& package_seconds, const EnergyMeter* energy) {
+    std::ofstream out(path, std::ios::trunc);
+    out << std::setprecision(9);
+    out << "{\n  \"tool\": \"bun_parallel\",\n  \"version\": 1,\n"
+        << "  \"label\": \"" << json_escape(label) << "\",\n"
+        << "  \"config\": {\"executor\": \"" << json_escape(executor) << "\", \"backend\": \""
+        << json_escape(backend) << "\", \"threads\": " << omp_get_max_threads() << ", \"dataset\": \""
+        << json_escape(dataset.filename().string()) << "\", \"packages\": " << package_seconds.size()
+        << ", \"outputs\": " << outputs << "},\n"
+        << "  \"wall_seconds\": " << seconds << ",\n"
+        << "  \"bytes_read\": " << g_copy_stats.bytes_read << ",\n"
+        << "  \"bytes_written\": " << g_copy_stats.bytes_written << ",\n";
+    if (energy) {
+        // Joules are null where no RAPL counter could be read.
+        auto joules = [&](double j) { return energy->has_rapl() ? std::to_string(j) : std::string("null"); };
+        out << "  \"energy\": {\"rapl\": " << (energy->has_rapl() ? "true" : "false") << ", \"phases\": [";
+        std::vector<EnergyPhase> phases = energy->phases();
+        phases.push_back(energy->total());
+        for (size_t i = 0; i < phases.size(); ++i) {
+            const EnergyPhase& p = phases[i];
+            out << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"seconds\": " << p.seconds
+                << ", \"package_joules\": " << joules(p.package_j) << ", \"dram_joules\": " << joules(p.dram_j)
+                << ", \"cpu_seconds\": " << p.cpu_seconds << "}";
+        }
+        out << "]},\n";
+    }
+    out << "  \"package_seconds\": [";
+    for (size_t i = 0; i < package_seconds.size(); ++i) out << (i ? ", " : "") << package_seconds[i];
+    out << "]\n}\n";
+    return static_cast<bool>(out);
+}
+
+// Measured cost of a package over earlier runs, kept in the first output
+// directory's install_history.txt as "<package> <seconds> <runs>" lines.
+// seconds is an exponentially weighted moving average of the package's wall
+// time, so a package that moved to slower storage is re-learned in a few runs.
+struct CostEstimate {
+    double seconds = 0;
+    uint64_t runs = 0;
+};
+
+constexpr double kCostAlpha = 0.3;  // EWMA weight of the newest measurement
+
+std::map<std::string, CostEstimate> read_cost_history(const fs::path& out_dir) {
+    std::map<std::string, CostEstimate> history;
+    std::ifstream in(out_dir / "install_history.txt");
+    std::string name;
+    CostEstimate c;
+    while (in >> name >> c.seconds >> c.runs) history[name] = c;
+    return history;
+}
+
+void write_cost_history(const fs::path& out_dir, const std::map<std::string, CostEstimate>& history) {
+    fs::path tmp = out_dir / ".install_history.txt.tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << std::setprecision(6);
+        for (const auto& [name, c] : history) out << name << " " << c.seconds << " " << c.runs << "\n";
+    }
+    std::error_code ec;
+    fs::rename(tmp, out_dir / "install_history.txt", ec);
+}
+
+// Makespan of list scheduling: packages are handed out in order, each to the
+// thread that becomes free first, as schedule(dynamic, 1) does.
+double simulate_makespan(const std::vector<double>& cost, const std::vector<size_t>& order, int threads) {
+    std::priority_queue<double, std::vector<double>, std::greater<double>> free_at;
+    for (int t = 0; t < threads; ++t) free_at.push(0);
+    double makespan = 0;
+    for (size_t i : order) {
+        double done = free_at.top() + cost[i];
+        free_at.pop();
+        free_at.push(done);
+        makespan = std::max(makespan, done);
+    }
+    return makespan;
+}
+
+// Library API (installer.h). A submission is an InstallJob; the pool hands
+// out its packages one at a time, taking the jobs in turn.
+struct InstallJob {
+    std::vector<fs::path> packages;
+    std::vector<fs::path> out_dirs;  // the one output directory
+    InstallOptions options;
+    InstallSettings settings;
+    LedgerReorder ledger;
+    std::vector<PackageResult> results;
+    size_t next = 0;  // next package to hand out, guarded by the pool's mutex
+    std::atomic<size_t> finished{0};
+    std::atomic<bool> cancelled{false};
+    std::promise<std::vector<PackageResult>> promise;
+};
+
+InstallHandle::InstallHandle(std::shared_ptr<InstallJob> job)
+    : job_(std::move(job)), future_(job_->promise.get_future().share()) {}
+
+void InstallHandle::cancel() {
+    if (job_) job_->cancelled = true;
+}
+
+size_t InstallHandle::completed() const { return job_ ? job_->finished.load() : 0; }
+size_t InstallHandle::total() const { return job_ ? job_->packages.size() : 0; }
+bool InstallHandle::done() const { return job_ && completed() == total(); }
+std::shared_future<std::vector<PackageResult>> InstallHandle::future() const { return future_; }
+const std::vector<PackageResult>& InstallHandle::wait() const { return future_.get(); }
+
+Installer::Installer(int threads) {
+    if (threads <= 0) threads = omp_get_max_threads();
+    for (int t = 0; t < threads; ++t) workers_.emplace_back([this] { work(); });
+}
+
+Installer::~Installer() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto& job : active_) job->cancelled = true;
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) w.join();
+}
+
+Installer& Installer::shared() {
+    static Installer pool;
+    return pool;
+}
+
+InstallHandle Installer::submit(const std::vector<fs::path>& packages, const fs::path& out_dir,
+                                InstallOptions options) {
+    auto job = std::make_shared<InstallJob>();
+    job->settings.upgrade = options.upgrade;
+    job->settings.sparse_copy = options.sparse;
+    for (const auto& [from, to] : options.relocate) {
+        if (from.size() < 2) throw std::invalid_argument("relocation prefix must be at least 2 bytes: " + from);
+        job->settings.relocations.push_back({from, to});
+    }
+    job->packages = packages;
+    job->out_dirs = {out_dir};
+    job->options = std::move(options);
+    job->results.resize(packages.size());
+    InstallHandle handle(job);
+    std::error_code ec;
+    fs::create_directories(out_dir, ec);
+    break_links_if_snapshot(out_dir);
+    job->ledger.reset(packages.size(), job->options.ledger_window, [out_dir](const std::string& records) {
+        std::ofstream db(out_dir / "install_db.txt", std::ios::app);
+        db << records;
+    });
+    if (packages.empty()) {
+        job->promise.set_value({});
+        return handle;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (stop_) job->cancelled = true;
+        active_.push_back(job);
+    }
+    cv_.notify_all();
+    return handle;
+}
+
+// Each turn takes one package from the job at the head of the queue and
+// moves that job to the back, so every active job gets every Nth worker.
+void Installer::work() {
+    t_quiet = true;
+    while (true) {
+        std::shared_ptr<InstallJob> job;
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [this] { return stop_ || !active_.empty(); });
+            if (active_.empty()) return;
+            job = active_.front();
+            active_.pop_front();
+            i = job->next++;
+            if (job->next < job->packages.size()) active_.push_back(job);
+        }
+
+        PackageResult& r = job->results[i];
+        r.name = package_name(job->packages[i]);
+        if (job->cancelled) {
+            r.status = PackageResult::kCancelled;
+            job->ledger.complete(i, {});
+        } else {
+            job->ledger.start(i);
+            bool ok = false;
+            t_install = &job->settings;
+            try {
+                ok = process_package(job->packages[i], job->out_dirs, job->ledger, i, &r);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << r.name << ": " << e.what() << "\n";
+            }
+            t_install = nullptr;
+            if (!ok) {
+                r.status = PackageResult::kFailed;
+                job->ledger.complete(i, {});
+            }
+        }
+
+        size_t done = ++job->finished;
+        if (job->options.on_package) job->options.on_package(r, done, job->packages.size());
+        if (done == job->packages.size()) {
+            write_install_merkle(job->out_dirs[0]);
+            job->promise.set_value(job->results);
+        }
+    }
+}
+
+#ifndef BUN_LIBRARY
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <packages_list.txt> <output_dir>\n";
+    // Options may appear anywhere; the remaining arguments are positional.
+    std::vector<std::string> args;
+    std::string mode = "install";
+    bool use_trash = false;
+    bool snapshot = false;
+    bool background_fill = false;
+    std::string trace_file;
+    bool lpt = false;
+    bool energy = false;
+    size_t ledger_window = 1024;
+    bool show_histograms = false;
+    size_t stragglers = 0;
+    std::string report_file;
+    std::string report_label = "unlabelled";
+    std::string sample_file;
+    int sample_ms = 100;
+    std::string hist_file;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        int w = workload_parse_option(i, argc, argv, g_workload);
+        if (w == 0) w = io_shim_parse_option(i, argc, argv);
+        if (w == 0) w = hedge_parse_option(i, argc, argv);
+        if (w < 0) return 1;
+        if (w > 0) continue;
+        if (a == "--no-sparse") {
+            g_install.sparse_copy = false;
+        } else if (a == "--upgrade") {
+            g_install.upgrade = true;
+        } else if (a == "--uninstall") {
+            mode = "uninstall";
+        } else if (a == "--prune") {
+            mode = "prune";
+        } else if (a == "--trash") {
+            use_trash = true;
+        } else if (a == "--snapshot") {
+            snapshot = true;
+        } else if (a == "--rollback") {
+            mode = "rollback";
+        } else if (a == "--compare") {
+            mode = "compare";
+        } else if (a == "--lazy") {
+            g_lazy = true;
+        } else if (a == "--background-fill") {
+            g_lazy = true;
+            background_fill = true;
+        } else if (a == "--materialize") {
+            mode = "materialize";
+        } else if (a == "--pack") {
+            mode = "pack";
+        } else if (a == "--relocate" && i + 1 < argc) {
+            std::string rule = argv[++i];
+            size_t eq = rule.find('=');
+            if (eq == std::string::npos || eq < 2) {
+                std::cerr << "Error: --relocate expects FROM=TO with FROM at least 2 bytes\n";
+                return 1;
+            }
+            g_install.relocations.push_back({rule.substr(0, eq), rule.substr(eq + 1)});
+        } else if (a == "--ledger-window" && i + 1 < argc) {
+            ledger_window = std::max(1L, std::atol(argv[++i]));
+        } else if (a == "--energy") {
+            energy = true;
+        } else if (a == "--lpt") {
+            lpt = true;
+        } else if (a == "--stragglers" && i + 1 < argc) {
+            stragglers = std::strtoul(argv[++i], nullptr, 10);
+        } else if (a == "--report-json" && i + 1 < argc) {
+            report_file = argv[++i];
+        } else if (a == "--report-label" && i + 1 < argc) {
+            report_label = argv[++i];
+        } else if (a == "--sample" && i + 1 < argc) {
+            sample_file = argv[++i];
+        } else if (a == "--sample-ms" && i + 1 < argc) {
+            sample_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (a == "--histograms") {
+            show_histograms = true;
+        } else if (a == "--hist-out" && i + 1 < argc) {
+            hist_file = argv[++i];
+        } else if (a == "--record-trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (a == "--calibrate") {
+            mode = "calibrate";
+        } else if (a == "--extract") {
+            mode = "extract";
+        } else if (a == "--verify-archive") {
+            mode = "verify-archive";
+        } else if (a.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option: " << a << "\n";
+            return 1;
+        } else {
+            args.push_back(a);
+        }
+    }
+    // Rollback takes only output directories.
+    if (mode == "rollback" && !args.empty()) {
+        int rc = 0;
+        for (const auto& a : args) rc |= run_rollback(a);
+        return rc;
+    }
+    // Materialize takes an output directory and optional package names.
+    if (mode == "materialize" && !args.empty()) {
+        break_links_if_snapshot(args[0]);
+        return run_materialize(args[0], std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+    if (mode == "calibrate" && args.size() == 1) {
+        return run_calibrate(args[0]);
+    }
+    if (mode == "extract" && args.size() >= 2) {
+        break_links_if_snapshot(args[1]);
+        return run_extract(args[0], args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    }
+    if (mode == "verify-archive" && !args.empty()) {
+        return run_verify_archive(args[0], std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+    if (g_lazy && g_install.upgrade) {
+        std::cerr << "Error: --lazy cannot be combined with --upgrade\n";
+        return 1;
+    }
+    if (mode == "compare" && args.size() == 2) {
+        return run_compare(args[0], args[1]);
+    }
+    if (args.size() < 2 || (mode != "install" && mode != "uninstall" && mode != "prune" && mode != "pack")) {
+        std::cerr << "Usage: " << argv[0] << " [--no-sparse] [--upgrade] [--snapshot] [--lazy|--background-fill]\n"
+                  << "       " << std::string(std::strlen(argv[0]), ' ') << " [--relocate FROM=TO]... [--work-* ...] [--io-* ...]\n"
+                  << "       " << std::string(std::strlen(argv[0]), ' ') << " [--lpt] [--ledger-window N] [--histograms] [--hist-out FILE] [--stragglers N]\n"
+                  << "       " << std::string(std::strlen(argv[0]), ' ') << " [--sample FILE [--sample-ms N]] [--energy] [--report-json FILE [--report-label L]]\n"
+                  << "       " << std::string(std::strlen(argv[0]), ' ') << " [--record-trace FILE] [--hedge P] <packages_list.txt> <output_dir> [<output_dir>...]\n"
+                  << "       " << argv[0] << " --uninstall|--prune [--trash] <packages_list.txt> <output_dir> [<output_dir>...]\n"
+                  << "       " << argv[0] << " --rollback <output_dir> [<output_dir>...]\n"
+                  << "       " << argv[0] << " --compare <output_dir> <output_dir>\n"
+                  << "       " << argv[0] << " --materialize <output_dir> [<package>...]\n"
+                  << "       " << argv[0] << " --pack <packages_list.txt> <archive_dir>\n"
+                  << "       " << argv[0] << " --calibrate <output_dir>\n"
+                  << "       " << argv[0] << " --extract <archive.bpk> <dir> [<entry>...]\n"
+                  << "       " << argv[0] << " --verify-archive <archive.bpk> [<entry>...]\n";
         return 1;
     }
-    fs::path listfile = argv[1];
-    fs::path outdir = argv[2];
-    fs::create_directories(outdir);
+    // Energy and CPU time of the run, split into prepare, install and
+    // finalize phases (--energy).
+    EnergyMeter meter;
+    if (energy) meter.start();
+
+    fs::path listfile = args[0];
+    std::vector<fs::path> outdirs(args.begin() + 1, args.end());
+    for (const auto& outdir : outdirs) {
+        fs::create_directories(outdir);
+        break_links_if_snapshot(outdir);
+    }
 
     std::vector<fs::path> pkg_dirs;
     std::ifstream in(listfile);
@@ -122,12 +2215,122 @@ int main(int argc, char** argv) {
         pkg_dirs.push_back(fs::path(line));
     }
 
+    // Uninstall removes the listed packages; prune removes every installed
+    // package that is not listed. Both work from each target's ledger.
+    if (mode == "uninstall" || mode == "prune") {
+        std::unordered_set<std::string> listed;
+        for (const auto& p : pkg_dirs) listed.insert(package_name(p));
+        int rc = 0;
+        for (const auto& outdir : outdirs) {
+            std::vector<std::string> names;
+            for (const auto& name : read_ledger_packages(outdir)) {
+                if ((listed.count(name) != 0) == (mode == "uninstall")) names.push_back(name);
+            }
+            rc |= run_remove(names, outdir, use_trash);
+        }
+        return rc;
+    }
+
+    if (mode == "pack") {
+        return run_pack(pkg_dirs, outdirs[0]);
+    }
+
+    if (snapshot) {
+        for (const auto& outdir : outdirs) {
+            if (!take_snapshot(outdir)) {
+                std::cerr << "Error: Cannot snapshot " << outdir.string() << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // Predicted cost of every package from earlier runs. Packages without
+    // history are assumed to cost the mean of those with one. With --lpt the
+    // most expensive packages are handed out first (longest processing time
+    // first), so no long package starts last and holds up the run alone.
+    auto history = read_cost_history(outdirs[0]);
+    std::vector<double> predicted(pkg_dirs.size(), -1);
+    double known_total = 0;
+    size_t known = 0;
+    for (size_t i = 0; i < pkg_dirs.size(); ++i) {
+        auto it = history.find(package_name(pkg_dirs[i]));
+        if (it == history.end()) continue;
+        predicted[i] = it->second.seconds;
+        known_total += it->second.seconds;
+        ++known;
+    }
+    std::vector<bool> from_history(pkg_dirs.size());
+    for (size_t i = 0; i < predicted.size(); ++i) {
+        from_history[i] = predicted[i] >= 0;
+        if (!from_history[i]) predicted[i] = known ? known_total / known : 0;
+    }
+    std::vector<size_t> order(pkg_dirs.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (lpt) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return predicted[a] > predicted[b]; });
+    }
+    std::vector<double> measured(pkg_dirs.size(), 0);
+
     int total_packages = pkg_dirs.size();
     int completed_packages = 0;
+    int failed_packages = 0;
+    workload_calibrate(g_workload);
+    if (!trace_file.empty()) {
+        if (!g_trace.open(trace_file, omp_get_max_threads())) {
+            std::cerr << "Error: Cannot create trace " << trace_file << "\n";
+            return 1;
+        }
+        g_tracing = true;
+    }
+
+    if (stragglers > 0) {
+        g_slow_packages.assign(omp_get_max_threads(), StragglerTop(stragglers));
+        g_slow_files.assign(omp_get_max_threads(), StragglerTop(stragglers));
+    }
+    if (show_histograms || !hist_file.empty()) {
+        for (int t = 0; t < omp_get_max_threads(); ++t) g_file_hists.push_back(std::make_unique<FileHistograms>());
+    }
+
+    // Ledger records are appended in list order, whatever order the packages
+    // finish in, so two installs of the same list have the same ledger.
+    LedgerReorder ledger;
+    ledger.reset(pkg_dirs.size(), ledger_window, [&](const std::string& records) {
+        for (const auto& outdir : outdirs) {
+            fs::path dbfile = outdir / "install_db.txt";
+            auto began = Clock::now();
+            std::ofstream db(dbfile, std::ios::app);
+            db << records;
+            db.close();
+            trace_op(TraceOp::Write, dbfile, 0, records.size(), began, db ? 0 : EIO);
+        }
+    });
 
     std::cout << "Starting parallel processing of " << total_packages << " packages...\n"
               << "Max threads: " << omp_get_max_threads() << "\n\n";
     
+    // Machine state sampled alongside the progress counters (--sample).
+    SystemSampler sampler;
+    if (!sample_file.empty()) {
+        auto progress = [&] {
+            int done;
+            uint64_t rd, wr;
+            #pragma omp atomic read
+            done = completed_packages;
+            #pragma omp atomic read
+            rd = g_copy_stats.bytes_read;
+            #pragma omp atomic read
+            wr = g_copy_stats.bytes_written;
+            std::ostringstream cols;
+            cols << done << "," << std::fixed << std::setprecision(2) << rd / 1e6 << "," << wr / 1e6;
+            return cols.str();
+        };
+        if (!sampler.start(sample_file, sample_ms, "packages_done,read_mb,written_mb", progress)) {
+            std::cerr << "Error: Cannot create sample file " << sample_file << "\n";
+            return 1;
+        }
+    }
+
+    if (energy) meter.mark("prepare");
     auto t0 = Clock::now();
 
     // This is the main parallel loop.
@@ -135,8 +2338,16 @@ int main(int argc, char** argv) {
     // schedule(dynamic, 1): Each thread grabs 1 iteration (package) at a time.
     //   'dynamic' is good for when iterations have varying workloads.
     #pragma omp parallel for schedule(dynamic, 1)
-    for (size_t i = 0; i < pkg_dirs.size(); ++i) {
-        process_package(pkg_dirs[i], outdir);
+    for (size_t k = 0; k < order.size(); ++k) {
+        const size_t i = order[k];
+        auto p0 = Clock::now();
+        ledger.start(i);
+        if (!process_package(pkg_dirs[i], outdirs, ledger, i)) {
+            ledger.complete(i, {});
+            #pragma omp atomic
+            failed_packages++;
+        }
+        measured[i] = std::chrono::duration<double>(Clock::now() - p0).count();
         
         // Atomically increment the counter for completed packages.
         // This is a lightweight way to handle a shared counter without a full lock.
@@ -156,12 +2367,160 @@ int main(int argc, char** argv) {
 
     auto t1 = Clock::now();
     std::chrono::duration<double> dur = t1 - t0;
+    uint64_t samples = sampler.stop();
+    if (energy) meter.mark("install");
+
+    for (const auto& outdir : outdirs) write_install_merkle(outdir);
+    // Lazy installs only write indexes, so their timings say nothing about
+    // the cost of a full install.
+    if (!g_lazy) {
+        for (size_t i = 0; i < pkg_dirs.size(); ++i) {
+            CostEstimate& c = history[package_name(pkg_dirs[i])];
+            c.seconds = c.runs ? kCostAlpha * measured[i] + (1 - kCostAlpha) * c.seconds : measured[i];
+            c.runs++;
+        }
+        write_cost_history(outdirs[0], history);
+    }
+    FileHistograms file_hists;
+    for (const auto& h : g_file_hists) file_hists.merge(*h);
+    if (!hist_file.empty() && !write_file_histograms(hist_file, file_hists, omp_get_max_threads())) {
+        std::cerr << "Error: Cannot write histograms to " << hist_file << "\n";
+    }
+    uint64_t trace_records = 0;
+    if (g_tracing) {
+        g_tracing = false;
+        trace_records = g_trace.close();
+    }
+    if (energy) meter.mark("finalize");
+    if (!report_file.empty()) {
+        // The backend names the I/O path the reads took.
+        std::string backend = g_hedge.enabled() ? "pread+hedge" : "pread";
+        if (g_io_shim.enabled()) backend += "+shim";
+        if (!write_json_report(report_file, report_label, lpt ? "omp-lpt" : "omp-dynamic", backend, listfile,
+                               outdirs.size(), dur.count(), measured,
+                               energy ? &meter : nullptr)) {
+            std::cerr << "Error: Cannot write report " << report_file << "\n";
+        }
+    }
 
     std::cout << "\n--------------------------------------------------\n";
     std::cout << "Processed " << total_packages << " packages in "
               << std::fixed << std::setprecision(4) << dur.count()
               << " seconds (parallel, threads=" << omp_get_max_threads() << ").\n";
+    if (failed_packages) std::cout << failed_packages << " packages failed and were not recorded.\n";
+    std::cout << "Read " << g_copy_stats.bytes_read << " bytes, wrote "
+              << g_copy_stats.bytes_written << " bytes, "
+              << g_copy_stats.bytes_sparse << " bytes left sparse, "
+              << g_copy_stats.bytes_cloned << " bytes reflinked.\n";
+    Calibration calibration = read_calibration(outdirs[0]);
+    if (!calibration.empty() && dur.count() > 0) print_roofline(calibration, dur.count(), g_copy_stats.files_read);
+    if (g_workload.enabled()) {
+        std::cout << workload_describe(g_workload) << " [" << (g_workload_sink & 0xF) << "]\n";
+    }
+    if (g_io_shim.enabled()) {
+        std::cout << "I/O shim (seed " << g_io_shim.seed << "): " << g_io_shim_stats.ops << " ops, "
+                  << std::setprecision(1) << g_io_shim_stats.delay_us / 1000.0 << " ms injected delay, "
+                  << g_io_shim_stats.errors << " errors injected, " << g_io_shim_stats.retries
+                  << " retries, " << g_io_shim_stats.failures << " failed after retries.\n";
+    }
+    if (lpt) {
+        // Replays this run's measured package times through both schedules,
+        // so the comparison is not skewed by run-to-run noise.
+        const int threads = omp_get_max_threads();
+        double error = 0, sum = 0, longest = 0;
+        for (size_t i = 0; i < pkg_dirs.size(); ++i) {
+            if (from_history[i] && measured[i] > 0) {
+                error += std::abs(predicted[i] - measured[i]) / measured[i];
+            }
+            sum += measured[i];
+            longest = std::max(longest, measured[i]);
+        }
+        std::vector<size_t> list_order(pkg_dirs.size());
+        std::iota(list_order.begin(), list_order.end(), 0);
+        double dynamic_span = simulate_makespan(measured, list_order, threads);
+        double lpt_span = simulate_makespan(measured, order, threads);
+        std::cout << "LPT schedule: " << known << " of " << total_packages << " packages predicted from history";
+        if (known) std::cout << " (mean error " << std::setprecision(1) << 100.0 * error / known << "%)";
+        std::cout << ".\n" << std::setprecision(4) << "Simulated makespan " << lpt_span << " s vs " << dynamic_span
+                  << " s for dynamic,1 in list order (" << std::setprecision(1)
+                  << (dynamic_span > 0 ? 100.0 * (dynamic_span - lpt_span) / dynamic_span : 0.0)
+                  << "% shorter); lower bound " << std::setprecision(4) << std::max(sum / threads, longest) << " s.\n";
+    }
+    if (g_hedge.enabled()) {
+        const HedgeStats& h = g_hedge_stats;
+        std::cout << "Hedged reads (p" << std::setprecision(1) << g_hedge.percentile << ", threshold now " << hedge_threshold_us()
+                  << " us): " << h.hedges << " of " << h.reads << " reads hedged, " << h.hedge_wins
+                  << " answered by the hedge.\n";
+        std::cout << "Read latency p50/p99/p99.9: " << h.observed.value_at(50) << "/" << h.observed.value_at(99)
+                  << "/" << h.observed.value_at(99.9) << " us hedged vs " << h.primary.value_at(50) << "/"
+                  << h.primary.value_at(99) << "/" << h.primary.value_at(99.9) << " us for the first copies alone.\n";
+    }
+    if (!sample_file.empty()) {
+        std::cout << "Sampled " << samples << " rows to " << sample_file << ": mean CPU busy " << std::setprecision(1)
+                  << sampler.mean_busy() << "%, iowait " << sampler.mean_iowait() << "%, peak disk util "
+                  << sampler.peak_disk_util() << "%, peak queue depth " << std::setprecision(2)
+                  << sampler.peak_queue() << ".\n";
+    }
+    if (ledger.stalls()) {
+        std::cout << "Ledger window (" << ledger_window << " records) full " << ledger.stalls()
+                  << " times; workers waited " << std::setprecision(1) << 1e3 * ledger.stalled_seconds()
+                  << " ms for earlier packages.\n";
+    }
+    if (energy) print_energy(meter, total_packages, g_copy_stats.bytes_written);
+    if (!trace_file.empty()) {
+        std::cout << "Recorded " << trace_records << " I/O operations to " << trace_file << ".\n";
+    }
+    if (!g_install.relocations.empty()) {
+        std::cout << "Relocated " << g_copy_stats.relocations << " prefixes in "
+                  << g_copy_stats.files_relocated << " files";
+        if (g_copy_stats.relocations_skipped) {
+            std::cout << " (" << g_copy_stats.relocations_skipped
+                      << " binary occurrences skipped: replacement longer than prefix)";
+        }
+        std::cout << ".\n";
+    }
+    if (g_install.upgrade) {
+        std::cout << "Upgrade: " << g_copy_stats.files_unchanged << " files unchanged, "
+                  << g_copy_stats.files_removed << " files removed.\n";
+    }
+    if (show_histograms) {
+        std::cout << "Per-file latency by size class:\n";
+        print_file_histograms(std::cout, file_hists);
+    }
+    if (outdirs.size() > 1) {
+        // N separate runs would each read the sources and write what the
+        // first target received (holes, unchanged files and relocation
+        // included), so both sides count the same bytes.
+        uint64_t separate = outdirs.size() * (g_copy_stats.bytes_read + g_copy_stats.bytes_written_first);
+        uint64_t fanout = g_copy_stats.bytes_read + g_copy_stats.bytes_written;
+        std::cout << "Fan-out to " << outdirs.size() << " targets moved " << fanout
+                  << " bytes vs " << separate << " for separate runs ("
+                  << std::fixed << std::setprecision(1)
+                  << (separate ? 100.0 * fanout / separate : 0.0) << "%).\n";
+    }
     std::cout << "--------------------------------------------------\n";
 
-    return 0;
-}
\ No newline at end of file
+    if (stragglers > 0) {
+        StragglerTop slow_packages(stragglers), slow_files(stragglers);
+        for (const auto& t : g_slow_packages) slow_packages.merge(t);
+        for (const auto& t : g_slow_files) slow_files.merge(t);
+        print_stragglers(std::cout, "Slowest packages", slow_packages.sorted());
+        print_stragglers(std::cout, "Slowest files", slow_files.sorted());
+    }
+
+    // Fill lazily installed packages from a child process so the install
+    // returns as soon as the indexes exist. The child runs serially.
+    if (background_fill) {
+        std::cout.flush();
+        if (::fork() == 0) {
+            omp_set_num_threads(1);
+            g_hedge.percentile = 0;  // the hedge pool's threads did not survive the fork
+            std::cout.setstate(std::ios::failbit);
+            for (const auto& outdir : outdirs) run_materialize(outdir, {});
+            ::_exit(0);
+        }
+    }
+
+    return failed_packages ? 1 : 0;
+}
+#endif  // BUN_LIBRARY
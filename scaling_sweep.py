@@ -0,0 +1,85 @@
+"""Thread-scaling sweep of bun_parallel with energy accounting.
+
+Installs the same package list once per thread count into a fresh output
+directory, with --energy and --report-json, and prints wall time, speedup,
+CPU seconds per package and, where RAPL counters are readable, joules per GB
+written, joules per package and packages per joule. Packages per joule
+falling while the speedup still grows is the point past which more threads
+cost more energy than they save.
+
+Every run starts from an empty output directory. bun_parallel learns package
+costs in install_history.txt there, so with --lpt one warm-up run comes
+first and its history is copied into each run's directory; otherwise every
+run would see no history and fall back to list order.
+
+Usage: python scaling_sweep.py [--threads 1,2,4,8] [--binary ./bun_parallel]
+                               [--keep-reports DIR] <packages_list.txt> <scratch_dir>
+                               [-- extra bun_parallel options]
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+
+def run_once(binary, listfile, scratch, threads, extra, report, history=None):
+    outdir = os.path.join(scratch, f"t{threads}")
+    shutil.rmtree(outdir, ignore_errors=True)
+    if history:
+        os.makedirs(outdir)
+        shutil.copy(history, os.path.join(outdir, "install_history.txt"))
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    cmd = [binary, "--energy", "--report-json", report, "--report-label", f"t{threads}"] + extra + [listfile, outdir]
+    subprocess.run(cmd, env=env, check=True, stdout=subprocess.DEVNULL)
+    with open(report) as f:
+        return json.load(f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Thread-scaling sweep with energy accounting")
+    parser.add_argument("--threads", default="1,2,4,8")
+    parser.add_argument("--binary", default="./bun_parallel")
+    parser.add_argument("--keep-reports", metavar="DIR")
+    parser.add_argument("listfile")
+    parser.add_argument("scratch")
+    parser.add_argument("extra", nargs="*")
+    args = parser.parse_args()
+
+    os.makedirs(args.scratch, exist_ok=True)
+    report_dir = args.keep_reports or args.scratch
+    os.makedirs(report_dir, exist_ok=True)
+
+    history = None
+    if "--lpt" in args.extra:
+        warm = os.path.join(args.scratch, "warmup")
+        shutil.rmtree(warm, ignore_errors=True)
+        subprocess.run([args.binary] + args.extra + [args.listfile, warm], check=True, stdout=subprocess.DEVNULL)
+        history = os.path.join(args.scratch, "install_history.txt")
+        shutil.copy(os.path.join(warm, "install_history.txt"), history)
+        shutil.rmtree(warm, ignore_errors=True)
+
+    print(f"{'threads':>7} {'wall s':>9} {'speedup':>8} {'CPU ms/pkg':>11} {'J/GB':>9} {'J/pkg':>9} {'pkg/J':>8}")
+    base_wall = None
+    for threads in [int(t) for t in args.threads.split(",")]:
+        report = os.path.join(report_dir, f"sweep_t{threads}.json")
+        r = run_once(args.binary, args.listfile, args.scratch, threads, args.extra, report, history)
+        total = r["energy"]["phases"][-1]
+        packages = r["config"]["packages"]
+        wall = r["wall_seconds"]
+        base_wall = base_wall or wall
+        row = f"{threads:>7} {wall:>9.4f} {base_wall / wall:>8.2f} {1e3 * total['cpu_seconds'] / packages:>11.3f}"
+        if r["energy"]["rapl"]:
+            joules = total["package_joules"] + total["dram_joules"]
+            gb = r["bytes_written"] / 1e9
+            row += f" {joules / gb if gb else 0:>9.2f} {joules / packages:>9.4f} {packages / joules if joules else 0:>8.1f}"
+        else:
+            row += f" {'-':>9} {'-':>9} {'-':>8}"
+        print(row, flush=True)
+        shutil.rmtree(os.path.join(args.scratch, f"t{threads}"), ignore_errors=True)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
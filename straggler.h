@@ -0,0 +1,102 @@
+// straggler.h
+// Top-N straggler report (--stragglers N): the slowest packages and files of a
+// run with where their time went, so the tail of a slow run can be traced to
+// a phase (storage, CPU or the ledger window) and to the thread and CPU it ran
+// on. Every thread keeps its own bounded min-heaps; they are merged after the
+// install loop.
+
+#pragma once
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Seconds spent in each phase of a file or package. For a package, the file
+// phases are summed and ledger_wait is the time spent handing the ledger
+// record to the reorder buffer (ledger_reorder.h), mostly waiting for room in
+// its window; the report shows the rest (manifest, directory listing, Merkle
+// root, logging) as "other".
+struct PhaseTimes {
+    double open = 0;
+    double read = 0;
+    double hash = 0;
+    double write = 0;
+    double meta = 0;
+    double ledger_wait = 0;
+
+    void add(const PhaseTimes& o) {
+        open += o.open;
+        read += o.read;
+        hash += o.hash;
+        write += o.write;
+        meta += o.meta;
+        ledger_wait += o.ledger_wait;
+    }
+
+    double sum() const { return open + read + hash + write + meta + ledger_wait; }
+};
+
+struct Straggler {
+    double seconds = 0;
+    std::string name;  // package, or package/file
+    PhaseTimes phases;
+    int thread = 0;
+    int cpu = -1;
+};
+
+// The n slowest entries offered so far, kept as a min-heap so the fastest of
+// them is the one replaced.
+class StragglerTop {
+public:
+    explicit StragglerTop(size_t n = 0) : n_(n) {}
+
+    // Cheap rejection first: most entries are not among the slowest, and
+    // building a Straggler costs a string.
+    bool wants(double seconds) const { return n_ > 0 && (heap_.size() < n_ || seconds > heap_.front().seconds); }
+
+    void offer(Straggler s) {
+        if (!wants(s.seconds)) return;
+        if (heap_.size() == n_) {
+            std::pop_heap(heap_.begin(), heap_.end(), slower);
+            heap_.pop_back();
+        }
+        heap_.push_back(std::move(s));
+        std::push_heap(heap_.begin(), heap_.end(), slower);
+    }
+
+    void merge(const StragglerTop& o) {
+        for (const auto& s : o.heap_) offer(s);
+    }
+
+    // Slowest first.
+    std::vector<Straggler> sorted() const {
+        std::vector<Straggler> v = heap_;
+        std::sort(v.begin(), v.end(), slower);
+        return v;
+    }
+
+private:
+    static bool slower(const Straggler& a, const Straggler& b) { return a.seconds > b.seconds; }
+
+    size_t n_;
+    std::vector<Straggler> heap_;
+};
+
+inline void print_stragglers(std::ostream& out, const char* title, const std::vector<Straggler>& v) {
+    if (v.empty()) return;
+    out << title << " (ms):\n"
+        << std::right << std::setw(10) << "total" << std::setw(9) << "open" << std::setw(9) << "read"
+        << std::setw(9) << "hash" << std::setw(9) << "write" << std::setw(9) << "meta" << std::setw(9) << "ledger"
+        << std::setw(9) << "other" << std::setw(7) << "thread" << std::setw(5) << "cpu" << "  name\n";
+    out << std::fixed << std::setprecision(2);
+    for (const auto& s : v) {
+        const PhaseTimes& p = s.phases;
+        out << std::setw(10) << 1e3 * s.seconds << std::setw(9) << 1e3 * p.open << std::setw(9) << 1e3 * p.read
+            << std::setw(9) << 1e3 * p.hash << std::setw(9) << 1e3 * p.write << std::setw(9) << 1e3 * p.meta
+            << std::setw(9) << 1e3 * p.ledger_wait << std::setw(9) << 1e3 * std::max(0.0, s.seconds - p.sum())
+            << std::setw(7) << s.thread << std::setw(5) << s.cpu << "  "
+            << s.name << "\n";
+    }
+}
@@ -0,0 +1,187 @@
+// sys_sampler.h
+// Background sampler of machine state for the parallel simulator (--sample).
+// At a fixed interval it reads /proc/stat (per-core CPU busy and iowait,
+// context switches), /proc/diskstats (per-disk utilisation and average queue
+// depth) and /proc/meminfo (page cache), and writes one CSV row per sample
+// together with the engine's own progress counters, so a throughput plateau
+// can be matched to a saturated disk, saturated cores or, when neither is
+// busy while context switches climb, lock contention.
+//
+// Columns: t_s, then the caller's progress columns, then cpu_busy_pct,
+// iowait_pct, ctxt_per_s, cached_mb, cpu<N>_pct per core, and <disk>_util_pct
+// and <disk>_queue per whole disk (loop, ram and zram devices are skipped).
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+
+struct CpuTimes {
+    uint64_t busy = 0;
+    uint64_t iowait = 0;
+    uint64_t total = 0;
+};
+
+struct DiskTimes {
+    uint64_t io_ms = 0;        // time with I/O in flight
+    uint64_t weighted_ms = 0;  // in-flight time weighted by queue depth
+};
+
+struct SysSnapshot {
+    std::chrono::steady_clock::time_point at;
+    CpuTimes all;
+    std::vector<CpuTimes> cores;
+    std::vector<DiskTimes> disks;  // in SystemSampler::disks_ order
+    uint64_t ctxt = 0;
+    uint64_t cached_kb = 0;
+};
+
+class SystemSampler {
+public:
+    // Progress columns come from the engine: a header and a function that
+    // returns the matching comma-separated values.
+    bool start(const std::string& path, int interval_ms, const std::string& progress_header,
+               std::function<std::string()> progress) {
+        out_.open(path, std::ios::trunc);
+        if (!out_) return false;
+        interval_ = std::chrono::milliseconds(interval_ms);
+        progress_ = std::move(progress);
+        std::error_code ec;
+        for (const auto& e : std::filesystem::directory_iterator("/sys/block", ec)) {
+            std::string name = e.path().filename().string();
+            if (name.rfind("loop", 0) == 0 || name.rfind("ram", 0) == 0 || name.rfind("zram", 0) == 0) continue;
+            disks_.push_back(name);
+        }
+        prev_ = snapshot();
+        t0_ = prev_.at;
+        out_ << "t_s," << progress_header << ",cpu_busy_pct,iowait_pct,ctxt_per_s,cached_mb";
+        for (size_t c = 0; c < prev_.cores.size(); ++c) out_ << ",cpu" << c << "_pct";
+        for (const auto& d : disks_) out_ << "," << d << "_util_pct," << d << "_queue";
+        out_ << "\n";
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Takes a last sample and stops. Returns the number of rows written.
+    uint64_t stop() {
+        if (!thread_.joinable()) return 0;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+        sample();
+        out_.close();
+        return rows_;
+    }
+
+    ~SystemSampler() { stop(); }
+
+    // Run-wide means and peaks, for the summary line.
+    double mean_busy() const { return rows_ ? busy_sum_ / rows_ : 0; }
+    double mean_iowait() const { return rows_ ? iowait_sum_ / rows_ : 0; }
+    double peak_disk_util() const { return peak_util_; }
+    double peak_queue() const { return peak_queue_; }
+
+private:
+    SysSnapshot snapshot() const {
+        SysSnapshot s;
+        s.at = std::chrono::steady_clock::now();
+        std::ifstream stat("/proc/stat");
+        std::string line;
+        while (std::getline(stat, line)) {
+            std::istringstream in(line);
+            std::string key;
+            in >> key;
+            if (key.rfind("cpu", 0) == 0) {
+                uint64_t v[8] = {};
+                for (auto& x : v) in >> x;  // user nice system idle iowait irq softirq steal
+                CpuTimes t;
+                for (auto x : v) t.total += x;
+                t.iowait = v[4];
+                t.busy = t.total - v[3] - v[4];
+                if (key == "cpu") s.all = t;
+                else s.cores.push_back(t);
+            } else if (key == "ctxt") {
+                in >> s.ctxt;
+            }
+        }
+        s.disks.resize(disks_.size());
+        std::ifstream diskstats("/proc/diskstats");
+        while (std::getline(diskstats, line)) {
+            std::istringstream in(line);
+            unsigned major, minor;
+            std::string name;
+            uint64_t f[11] = {};
+            in >> major >> minor >> name;
+            for (auto& x : f) in >> x;
+            for (size_t d = 0; d < disks_.size(); ++d) {
+                if (disks_[d] == name) s.disks[d] = {f[9], f[10]};
+            }
+        }
+        std::ifstream meminfo("/proc/meminfo");
+        while (std::getline(meminfo, line)) {
+            if (line.rfind("Cached:", 0) == 0) s.cached_kb = std::stoull(line.substr(7));
+        }
+        return s;
+    }
+
+    static double pct(uint64_t part, uint64_t whole) { return whole ? 100.0 * part / whole : 0; }
+
+    void sample() {
+        SysSnapshot now = snapshot();
+        double dt = std::chrono::duration<double>(now.at - prev_.at).count();
+        double dt_ms = dt * 1e3;
+        if (dt <= 0) return;
+        double busy = pct(now.all.busy - prev_.all.busy, now.all.total - prev_.all.total);
+        double iowait = pct(now.all.iowait - prev_.all.iowait, now.all.total - prev_.all.total);
+        out_ << std::fixed << std::setprecision(3) << std::chrono::duration<double>(now.at - t0_).count() << ","
+             << progress_() << std::setprecision(1) << "," << busy << "," << iowait << ","
+             << (now.ctxt - prev_.ctxt) / dt << "," << now.cached_kb / 1024.0;
+        for (size_t c = 0; c < now.cores.size() && c < prev_.cores.size(); ++c) {
+            out_ << "," << pct(now.cores[c].busy - prev_.cores[c].busy, now.cores[c].total - prev_.cores[c].total);
+        }
+        for (size_t d = 0; d < disks_.size(); ++d) {
+            double util = 100.0 * (now.disks[d].io_ms - prev_.disks[d].io_ms) / dt_ms;
+            double queue = (now.disks[d].weighted_ms - prev_.disks[d].weighted_ms) / dt_ms;
+            out_ << "," << std::min(util, 100.0) << "," << std::setprecision(2) << queue << std::setprecision(1);
+            peak_util_ = std::max(peak_util_, std::min(util, 100.0));
+            peak_queue_ = std::max(peak_queue_, queue);
+        }
+        out_ << "\n";
+        busy_sum_ += busy;
+        iowait_sum_ += iowait;
+        rows_++;
+        prev_ = std::move(now);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) sample();
+    }
+
+    std::ofstream out_;
+    std::chrono::milliseconds interval_{100};
+    std::function<std::string()> progress_;
+    std::vector<std::string> disks_;
+    SysSnapshot prev_;
+    std::chrono::steady_clock::time_point t0_;
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    uint64_t rows_ = 0;
+    double busy_sum_ = 0, iowait_sum_ = 0, peak_util_ = 0, peak_queue_ = 0;
+};
@@ -0,0 +1,223 @@
+// trace_replay.cpp
+// Replays an I/O trace recorded with `bun_parallel --record-trace` against a
+// scratch directory, so changes to the I/O path can be benchmarked against a
+// production access pattern without the original package data.
+//
+// Every recorded thread is replayed on its own OpenMP thread, issuing its
+// operations in recorded order. Paths are mapped under the scratch directory;
+// files the trace reads are created and filled before the timed replay starts.
+//
+// Compile: g++ -O2 -fopenmp -std=c++17 trace_replay.cpp -o trace_replay
+// Usage: ./trace_replay [--speed X] <trace.bin> <scratch_dir>
+//   --speed X  1 (default) keeps the original timing, X > 1 compresses it by X,
+//              0 issues every operation as soon as the previous one finishes
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "io_trace.h"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// Maps a recorded path into the scratch directory. Absolute paths lose their
+// root and ".." components are renamed, so nothing escapes the scratch tree.
+fs::path scratch_path(const fs::path& scratch, const std::string& recorded) {
+    fs::path out = scratch;
+    for (const auto& part : fs::path(recorded).relative_path()) {
+        out /= part == ".." ? fs::path("__") : part;
+    }
+    return out;
+}
+
+// Per-operation-type replay totals.
+struct OpStats {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    double recorded_seconds = 0;
+};
+
+int main(int argc, char** argv) {
+    double speed = 1.0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--speed" && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+        } else {
+            args.push_back(a);
+        }
+    }
+    if (args.size() != 2 || speed < 0) {
+        std::cerr << "Usage: " << argv[0] << " [--speed X] <trace.bin> <scratch_dir>\n";
+        return 1;
+    }
+    fs::path scratch = args[1];
+
+    std::vector<TraceRecord> records;
+    std::vector<std::string> paths;
+    if (!trace_load(args[0], records, paths)) {
+        std::cerr << "Error: Cannot read trace " << args[0] << "\n";
+        return 1;
+    }
+    if (records.empty()) {
+        std::cout << "Trace " << args[0] << " has no operations.\n";
+        return 0;
+    }
+    std::vector<fs::path> mapped;
+    for (const auto& p : paths) mapped.push_back(scratch_path(scratch, p));
+
+    // Split the trace by recorded thread, each in time order.
+    std::map<uint16_t, std::vector<TraceRecord>> by_thread;
+    for (const auto& r : records) by_thread[r.thread].push_back(r);
+    std::vector<std::vector<TraceRecord>> streams;
+    for (auto& [tid, rs] : by_thread) {
+        std::sort(rs.begin(), rs.end(), [](const TraceRecord& a, const TraceRecord& b) { return a.t_ns < b.t_ns; });
+        streams.push_back(std::move(rs));
+    }
+
+    // Setup (untimed): every file the trace reads must exist and be as large
+    // as the furthest byte read from it.
+    std::unordered_map<uint32_t, uint64_t> read_extent;
+    for (const auto& r : records) {
+        if (static_cast<TraceOp>(r.op) == TraceOp::Read && r.err == 0) {
+            read_extent[r.path_id] = std::max(read_extent[r.path_id], r.offset + r.size);
+        }
+    }
+    std::vector<char> fill(1 << 20, static_cast<char>(0xA5));
+    for (const auto& [id, extent] : read_extent) {
+        fs::create_directories(mapped[id].parent_path());
+        int fd = ::open(mapped[id].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) continue;
+        for (uint64_t off = 0; off < extent; off += fill.size()) {
+            if (::pwrite(fd, fill.data(), std::min<uint64_t>(fill.size(), extent - off), off) < 0) break;
+        }
+        ::close(fd);
+    }
+    uint64_t max_io = 0;
+    for (const auto& r : records) max_io = std::max<uint64_t>(max_io, r.size);
+
+    std::cout << "Replaying " << records.size() << " operations on " << streams.size()
+              << " threads (speed " << speed << ")...\n";
+
+    const int nstreams = static_cast<int>(streams.size());
+    std::vector<std::map<TraceOp, OpStats>> thread_stats(nstreams);
+    uint64_t failures = 0;
+    auto t0 = Clock::now();
+
+    #pragma omp parallel num_threads(nstreams) reduction(+:failures)
+    {
+        int tid = omp_get_thread_num();
+        std::vector<char> buf(max_io, static_cast<char>(0x5A));
+        std::unordered_map<uint32_t, int> fds;  // recorded path -> open fd
+        auto fd_for = [&](uint32_t id, int flags) {
+            auto it = fds.find(id);
+            if (it != fds.end()) return it->second;
+            int fd = ::open(mapped[id].c_str(), flags | O_CLOEXEC, 0644);
+            if (fd >= 0) fds[id] = fd;
+            return fd;
+        };
+
+        for (const auto& r : streams[tid]) {
+            if (speed > 0) {
+                std::this_thread::sleep_until(t0 + std::chrono::nanoseconds(static_cast<int64_t>(r.t_ns / speed)));
+            }
+            const fs::path& p = mapped[r.path_id];
+            TraceOp op = static_cast<TraceOp>(r.op);
+            auto began = Clock::now();
+            long rc = 0;
+            switch (op) {
+            case TraceOp::Open: {
+                auto it = fds.find(r.path_id);
+                if (it != fds.end()) ::close(it->second);
+                fds.erase(r.path_id);
+                if ((r.offset & O_CREAT) || (r.offset & O_ACCMODE) != O_RDONLY) fs::create_directories(p.parent_path());
+                rc = fd_for(r.path_id, static_cast<int>(r.offset) & ~O_CLOEXEC);
+                break;
+            }
+            case TraceOp::Read:
+                rc = ::pread(fd_for(r.path_id, O_RDONLY), buf.data(), r.size, r.offset);
+                break;
+            case TraceOp::Write:
+                rc = ::pwrite(fd_for(r.path_id, O_WRONLY | O_CREAT), buf.data(), r.size, r.offset);
+                break;
+            case TraceOp::Close: {
+                auto it = fds.find(r.path_id);
+                if (it != fds.end()) {
+                    rc = ::close(it->second);
+                    fds.erase(it);
+                }
+                break;
+            }
+            case TraceOp::Stat: {
+                struct stat st;
+                rc = ::stat(p.c_str(), &st);
+                break;
+            }
+            case TraceOp::Mkdir: {
+                std::error_code ec;
+                fs::create_directories(p, ec);
+                rc = ec ? -1 : 0;
+                break;
+            }
+            case TraceOp::Fsync:
+                rc = ::fsync(fd_for(r.path_id, O_WRONLY));
+                break;
+            }
+            std::chrono::duration<double> took = Clock::now() - began;
+            // Only count failures the original run did not also see.
+            if (rc < 0 && r.err == 0) ++failures;
+            OpStats& st = thread_stats[tid][op];
+            st.count++;
+            st.bytes += (op == TraceOp::Read || op == TraceOp::Write) ? r.size : 0;
+            st.seconds += took.count();
+            st.recorded_seconds += r.dur_us / 1e6;
+        }
+        for (auto& [id, fd] : fds) ::close(fd);
+    }
+
+    std::chrono::duration<double> dur = Clock::now() - t0;
+    uint64_t span_ns = 0;
+    for (const auto& r : records) span_ns = std::max<uint64_t>(span_ns, r.t_ns + r.dur_us * 1000ULL);
+
+    std::map<TraceOp, OpStats> totals;
+    for (const auto& ts : thread_stats) {
+        for (const auto& [op, st] : ts) {
+            OpStats& t = totals[op];
+            t.count += st.count;
+            t.bytes += st.bytes;
+            t.seconds += st.seconds;
+            t.recorded_seconds += st.recorded_seconds;
+        }
+    }
+
+    std::cout << "\n--------------------------------------------------\n";
+    std::cout << std::left << std::setw(8) << "op" << std::right << std::setw(10) << "count"
+              << std::setw(14) << "bytes" << std::setw(14) << "mean us" << std::setw(14) << "recorded us" << "\n";
+    for (const auto& [op, st] : totals) {
+        std::cout << std::left << std::setw(8) << trace_op_name(op) << std::right << std::setw(10) << st.count
+                  << std::setw(14) << st.bytes << std::fixed << std::setprecision(1)
+                  << std::setw(14) << 1e6 * st.seconds / st.count
+                  << std::setw(14) << 1e6 * st.recorded_seconds / st.count << "\n";
+    }
+    std::cout << "Replayed " << records.size() << " operations in " << std::setprecision(4) << dur.count()
+              << " seconds (recorded span " << span_ns / 1e9 << " seconds, " << failures
+              << " new failures).\n";
+    std::cout << "--------------------------------------------------\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+// workload.h
+// Synthetic CPU workload model shared by the serial and parallel simulators.
+// checksum_bytes is otherwise the only CPU work per file; this adds tunable
+// extra compute so installs with heavier or lighter CPU phases (decompression,
+// transpilation, patching) can be modelled and the CPU/I/O ratio swept.
+//
+// Options (accepted by both binaries):
+//   --work-ns-per-kib N   calibrated busy spin of N ns per KiB of file data
+//   --work-us-per-file N  calibrated busy spin of N us per file
+//   --work-kernel K       real kernel per file: "lz" (compress + decompress
+//                         round trip) or "hash" (extra checksum pass)
+//   --work-rounds R       how many times the kernel runs per file (default 1)
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lz_codec.h"
+
+struct WorkloadModel {
+    double ns_per_kib = 0;
+    double us_per_file = 0;
+    std::string kernel;  // empty, "lz" or "hash"
+    int rounds = 1;
+    double spins_per_ns = 0;  // set by workload_calibrate
+
+    bool enabled() const { return ns_per_kib > 0 || us_per_file > 0 || !kernel.empty(); }
+};
+
+// One step of the spin loop: a dependent xorshift chain the compiler cannot
+// fold away or vectorise, so its cost per iteration is stable.
+inline uint64_t workload_spin(uint64_t iters, uint64_t x) {
+    for (uint64_t i = 0; i < iters; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    return x;
+}
+
+// Measures how many spin iterations fit in a nanosecond on this core. Done
+// once per run before any threads start.
+inline void workload_calibrate(WorkloadModel& w) {
+    if (w.ns_per_kib <= 0 && w.us_per_file <= 0) return;
+    using Clock = std::chrono::steady_clock;
+    uint64_t iters = 1 << 16;
+    volatile uint64_t sink = 0;
+    for (;;) {
+        auto t0 = Clock::now();
+        sink = workload_spin(iters, sink | 1);
+        std::chrono::duration<double, std::nano> dt = Clock::now() - t0;
+        if (dt.count() > 2e7 || iters > (uint64_t(1) << 40)) {  // at least 20 ms
+            w.spins_per_ns = iters / dt.count();
+            return;
+        }
+        iters *= 2;
+    }
+}
+
+// Parses one workload option at argv[i], advancing i past its value. Returns
+// 1 if the option was consumed, 0 if it is not a workload option, and -1 (after
+// printing an error) if its value is missing or invalid.
+inline int workload_parse_option(int& i, int argc, char** argv, WorkloadModel& w) {
+    std::string a = argv[i];
+    if (a != "--work-ns-per-kib" && a != "--work-us-per-file" && a != "--work-kernel" && a != "--work-rounds") {
+        return 0;
+    }
+    if (i + 1 >= argc) {
+        std::cerr << "Error: " << a << " needs a value\n";
+        return -1;
+    }
+    std::string v = argv[++i];
+    if (a == "--work-kernel") {
+        if (v != "lz" && v != "hash") {
+            std::cerr << "Error: --work-kernel must be lz or hash\n";
+            return -1;
+        }
+        w.kernel = v;
+        return 1;
+    }
+    char* end = nullptr;
+    double d = std::strtod(v.c_str(), &end);
+    if (*end != '\0' || d < 0) {
+        std::cerr << "Error: " << a << " expects a non-negative number\n";
+        return -1;
+    }
+    if (a == "--work-ns-per-kib") w.ns_per_kib = d;
+    else if (a == "--work-us-per-file") w.us_per_file = d;
+    else w.rounds = static_cast<int>(d);
+    return 1;
+}
+
+// Runs the modelled extra CPU work for one file of data. Returns a value
+// derived from the work so the compiler has to perform it.
+inline uint64_t workload_apply(const WorkloadModel& w, const std::vector<char>& data) {
+    uint64_t sink = data.size() | 1;
+    double ns = w.ns_per_kib * (data.size() / 1024.0) + w.us_per_file * 1000.0;
+    if (ns > 0) sink = workload_spin(static_cast<uint64_t>(ns * w.spins_per_ns), sink);
+
+    for (int r = 0; r < w.rounds && !w.kernel.empty(); ++r) {
+        if (w.kernel == "lz") {
+            std::vector<char> packed, unpacked(data.size());
+            lz_compress(data.data(), data.size(), packed);
+            lz_decompress(packed.data(), packed.size(), unpacked.data(), unpacked.size());
+            sink += packed.size() + (unpacked.empty() ? 0 : static_cast<unsigned char>(unpacked.back()));
+        } else {
+            uint64_t h = 1469598103934665603ULL + r;
+            for (char c : data) {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211ULL;
+            }
+            sink ^= h;
+        }
+    }
+    return sink;
+}
+
+// One-line description of the model for the run summary.
+inline std::string workload_describe(const WorkloadModel& w) {
+    std::ostringstream s;
+    s << "Workload model:";
+    if (w.ns_per_kib > 0) s << " " << w.ns_per_kib << " ns/KiB";
+    if (w.us_per_file > 0) s << " " << w.us_per_file << " us/file";
+    if (!w.kernel.empty()) s << " kernel=" << w.kernel << " x" << w.rounds;
+    if (w.spins_per_ns > 0) s << " (calibrated " << w.spins_per_ns << " spins/ns)";
+    return s.str();
+}